@@ -0,0 +1,274 @@
+"""Run the spmv variants over a list of matrices and thread/rank configurations.
+
+Every (matrix, variant, ranks, threads) point is run --reps times; the
+per-run SpMV times are summarised into one row of the results. Rows are
+written as CSV and/or JSON, printed as a comparison table, and optionally
+plotted in the style of graph.py. Results from earlier runs can be
+re-tabulated and re-plotted with --load, so several releases (--label) can
+be compared side by side.
+
+With --cg N the MPI variants instead run N iterations of classical and of
+pipelined CG (spmv --cg=N,0), and each configuration gives two rows,
+<variant>-cg and <variant>-pipecg, timed per iteration. Their GFLOP/s and
+GB/s are left empty (they count SpMV work only), and the omp variant, which
+has no CG, is skipped.
+
+Example:
+    python3 bench.py spmv-omp/example_matrices/*.mtx --threads 1,2,4 \\
+        --ranks 1,2 --reps 5 --csv results.csv --json results.json --plot results.png
+    python3 bench.py big_spd.mtx --variants mpi --ranks 1,2,4,8,16 --cg 200
+"""
+import argparse
+import csv
+import json
+import os
+import re
+import statistics
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+BINARIES = {
+    'omp': os.path.join(HERE, 'spmv-omp', 'spmv'),
+    'mpi': os.path.join(HERE, 'spmv-mpi', 'spmv'),
+    'hyb': os.path.join(HERE, 'spmv-hyb', 'spmv'),
+}
+FIELDS = ['label', 'matrix', 'variant', 'ranks', 'threads', 'rows', 'cols', 'nonzeros', 'reps',
+          'time_min', 'time_median', 'time_mean', 'time_max', 'time_stdev', 'gflops', 'gbytes']
+
+INFO_RE = re.compile(r'file=\S+ rows=(\d+) cols=(\d+) nonzeros=(\d+)')
+OMP_TIME_RE = re.compile(r'benchmarking COO-SpMV \([^)]*\):\s*([0-9.]+) ms')
+MPI_TIME_RE = re.compile(r'Single spMV run took ([0-9.]+) seconds')
+CG_TIME_RE = re.compile(r'CG \((classical|pipelined), \d+ ranks\): (\d+) iterations took ([0-9.]+) seconds')
+CG_SUFFIXES = {'classical': '-cg', 'pipelined': '-pipecg'}
+
+
+def bytes_moved(rows, cols, nnz):
+    """Compulsory traffic of one COO SpMV: the triplets, x once, y read and written."""
+    return 12 * nnz + 4 * cols + 8 * rows
+
+
+def command(variant, matrix, ranks, threads, mpirun, cg):
+    if variant == 'omp':
+        return [BINARIES['omp'], matrix]
+    extra = ['--cg=%d,0' % cg] if cg else []
+    return mpirun.split() + ['-np', str(ranks), '-x', 'OMP_NUM_THREADS', BINARIES[variant], matrix] + extra
+
+
+def run_once(variant, matrix, ranks, threads, mpirun, timeout, cg=0):
+    """Run one configuration; returns (rows, cols, nnz, {variant suffix: seconds}) or None on failure.
+
+    The suffix is '' for the SpMV time, or -cg / -pipecg for seconds per CG iteration with cg > 0.
+    """
+    env = dict(os.environ, OMP_NUM_THREADS=str(threads))
+    try:
+        out = subprocess.run(command(variant, matrix, ranks, threads, mpirun, cg), env=env, timeout=timeout,
+                             stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True).stdout
+    except subprocess.TimeoutExpired:
+        print('  timed out after %d s' % timeout, file=sys.stderr)
+        return None
+
+    info = INFO_RE.search(out)
+    if cg and variant != 'omp':
+        times = {CG_SUFFIXES[m.group(1)]: float(m.group(3)) / max(int(m.group(2)), 1)
+                 for m in CG_TIME_RE.finditer(out)}
+    else:
+        match = (OMP_TIME_RE if variant == 'omp' else MPI_TIME_RE).search(out)
+        times = {'': float(match.group(1)) / (1000.0 if variant == 'omp' else 1.0)} if match else {}
+    if info is None or not times:
+        print('  could not parse output:\n' + out, file=sys.stderr)
+        return None
+    return int(info.group(1)), int(info.group(2)), int(info.group(3)), times
+
+
+def configurations(variants, ranks, threads):
+    for variant in variants:
+        if variant == 'omp':
+            for t in threads:
+                yield variant, 1, t
+        elif variant == 'mpi':
+            for r in ranks:
+                yield variant, r, 1
+        else:
+            for r in ranks:
+                for t in threads:
+                    yield variant, r, t
+
+
+def benchmark(args):
+    results = []
+    for matrix in args.matrices:
+        for variant, ranks, threads in configurations(args.variants, args.ranks, args.threads):
+            print('%s %s ranks=%d threads=%d' % (os.path.basename(matrix), variant, ranks, threads), file=sys.stderr)
+            runs = [run_once(variant, matrix, ranks, threads, args.mpirun, args.timeout, args.cg)
+                    for _ in range(args.reps)]
+            runs = [r for r in runs if r is not None]
+            if not runs:
+                continue
+            rows, cols, nnz = runs[0][:3]
+            for suffix in sorted(runs[0][3]):
+                times = [r[3][suffix] for r in runs if suffix in r[3]]
+                results.append(summarise(args.label, matrix, variant + suffix, ranks, threads, rows, cols, nnz, times))
+    return results
+
+
+def summarise(label, matrix, variant, ranks, threads, rows, cols, nnz, times):
+    """Row of the results; rates are None for CG rows, whose times are per CG iteration, not per SpMV."""
+    median = statistics.median(times)
+    per_cg_iteration = variant.endswith(tuple(CG_SUFFIXES.values()))
+    return {
+        'label': label, 'matrix': os.path.splitext(os.path.basename(matrix))[0],
+        'variant': variant, 'ranks': ranks, 'threads': threads,
+        'rows': rows, 'cols': cols, 'nonzeros': nnz, 'reps': len(times),
+        'time_min': min(times), 'time_median': median, 'time_mean': statistics.mean(times),
+        'time_max': max(times), 'time_stdev': statistics.stdev(times) if len(times) > 1 else 0.0,
+        'gflops': None if per_cg_iteration else 2.0 * nnz / median / 1e9 if median > 0 else 0.0,
+        'gbytes': None if per_cg_iteration else bytes_moved(rows, cols, nnz) / median / 1e9 if median > 0 else 0.0,
+    }
+
+
+def load(paths):
+    results = []
+    for path in paths:
+        if path.endswith('.json'):
+            with open(path) as f:
+                results.extend(json.load(f))
+            continue
+        with open(path, newline='') as f:
+            for row in csv.DictReader(f):
+                for key in FIELDS[3:9]:
+                    row[key] = int(row[key])
+                for key in FIELDS[9:]:
+                    row[key] = float(row[key]) if row[key] != '' else None
+                results.append(row)
+    return results
+
+
+def config_name(row):
+    name = row['variant']
+    base = row['variant'].split('-')[0]
+    if base == 'omp':
+        name += '-t%d' % row['threads']
+    elif base == 'mpi':
+        name += '-r%d' % row['ranks']
+    else:
+        name += '-r%d-t%d' % (row['ranks'], row['threads'])
+    return name if not row['label'] else '%s@%s' % (name, row['label'])
+
+
+def rate(value):
+    return '-' if value is None else '%.3f' % value
+
+
+def print_table(results):
+    """One block per matrix; speedup is relative to the slowest configuration."""
+    for matrix in sorted(set(r['matrix'] for r in results)):
+        rows = sorted((r for r in results if r['matrix'] == matrix), key=lambda r: r['time_median'])
+        slowest = rows[-1]['time_median']
+        print('\n%s (rows=%d cols=%d nonzeros=%d)' % (matrix, rows[0]['rows'], rows[0]['cols'], rows[0]['nonzeros']))
+        print('\t%-24s %12s %12s %12s %9s %9s %8s' % ('config', 'median ms', 'min ms', 'stdev ms',
+                                                     'GFLOP/s', 'GB/s', 'speedup'))
+        for r in rows:
+            print('\t%-24s %12.4f %12.4f %12.4f %9s %9s %8.2f' % (
+                config_name(r), r['time_median'] * 1e3, r['time_min'] * 1e3, r['time_stdev'] * 1e3,
+                rate(r['gflops']), rate(r['gbytes']), slowest / r['time_median'] if r['time_median'] > 0 else 0.0))
+
+
+def plot(results, path):
+    """Grouped bars of median runtime, one group per matrix, as in graph.py."""
+    try:
+        import matplotlib
+        matplotlib.use('Agg')
+        import matplotlib.pyplot as plt
+    except ImportError:
+        print('matplotlib is not installed; skipping %s' % path, file=sys.stderr)
+        return
+
+    matrices = sorted(set(r['matrix'] for r in results))
+    configs = sorted(set(config_name(r) for r in results))
+    times = {(r['matrix'], config_name(r)): r['time_median'] for r in results}
+    bar_width = 0.8 / len(configs)
+
+    fig, ax = plt.subplots(figsize=(max(12, len(matrices) * len(configs) * 0.3), 6))
+    for i, config in enumerate(configs):
+        xs = [m + i * bar_width for m in range(len(matrices))]
+        ax.bar(xs, [times.get((matrix, config), 0.0) for matrix in matrices], width=bar_width, label=config)
+
+    ax.set_xlabel('Matrices')
+    ax.set_ylabel('Median runtime (s)')
+    ax.set_title('SpMV runtime by parallelization strategy')
+    ax.set_xticks([m + bar_width * (len(configs) - 1) / 2 for m in range(len(matrices))])
+    ax.set_xticklabels(matrices)
+    ax.legend()
+    plt.tight_layout()
+    plt.savefig(path)
+
+
+def int_list(text):
+    return [int(v) for v in text.split(',') if v]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('matrices', nargs='*', help='.mtx/.bin files, or text files listing one matrix per line')
+    parser.add_argument('--variants', default='omp,mpi,hyb', help='comma-separated subset of omp,mpi,hyb')
+    parser.add_argument('--threads', type=int_list, default=[1, 2, 4, 8], help='OpenMP thread counts (omp, hyb)')
+    parser.add_argument('--ranks', type=int_list, default=[1, 2, 4], help='MPI rank counts (mpi, hyb)')
+    parser.add_argument('--reps', type=int, default=5, help='runs per configuration')
+    parser.add_argument('--mpirun', default='mpirun --oversubscribe', help='MPI launcher command')
+    parser.add_argument('--cg', type=int, default=0,
+                        help='compare classical and pipelined CG over this many iterations (mpi, hyb) '
+                             'instead of timing one SpMV')
+    parser.add_argument('--timeout', type=int, default=600, help='seconds before a run is abandoned')
+    parser.add_argument('--label', default='', help='tag stored with every row, e.g. a release or commit')
+    parser.add_argument('--load', nargs='+', default=[], help='tabulate/plot existing CSV/JSON results instead')
+    parser.add_argument('--csv', help='write results as CSV')
+    parser.add_argument('--json', help='write results as JSON')
+    parser.add_argument('--plot', help='write a runtime bar chart (PNG)')
+    args = parser.parse_args()
+    args.variants = [v for v in args.variants.split(',') if v]
+    if args.cg and 'omp' in args.variants:
+        # A single OpenMP SpMV would share the CG rows' table and speedup column.
+        print('--cg: skipping omp, which has no CG', file=sys.stderr)
+        args.variants.remove('omp')
+
+    for v in args.variants:
+        if v not in BINARIES:
+            parser.error('unknown variant %s' % v)
+
+    # Expand list files into the matrices they name.
+    matrices = []
+    for m in args.matrices:
+        if m.endswith('.txt'):
+            with open(m) as f:
+                matrices.extend(line.strip() for line in f if line.strip() and not line.startswith('#'))
+        else:
+            matrices.append(m)
+    args.matrices = matrices
+
+    if args.load:
+        results = load(args.load)
+    else:
+        if not args.matrices:
+            parser.error('give at least one matrix or --load')
+        missing = [BINARIES[v] for v in args.variants if not os.path.exists(BINARIES[v])]
+        if missing:
+            parser.error('build first (make in each spmv directory): missing ' + ', '.join(missing))
+        results = benchmark(args)
+
+    if args.csv:
+        with open(args.csv, 'w', newline='') as f:
+            writer = csv.DictWriter(f, fieldnames=FIELDS)
+            writer.writeheader()
+            writer.writerows(results)
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(results, f, indent=2)
+
+    print_table(results)
+    if args.plot:
+        plot(results, args.plot)
+
+
+if __name__ == '__main__':
+    main()
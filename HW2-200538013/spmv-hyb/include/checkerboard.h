@@ -0,0 +1,175 @@
+#pragma once
+
+// 2D (checkerboard) distribution for the SpMV over a pr x pc process grid
+// (pr = pc = sqrt(P) when P is a square). Rank (i, j) holds the block of A
+// in row block i and column block j. x is split into P pieces: column block
+// j is divided among the pr ranks of process column j, and y's row block i
+// among the pc ranks of process row i. One multiply is
+//   expand:   Allgatherv of the x pieces within the process column,
+//   multiply: the local block times its column block of x,
+//   fold:     Reduce_scatter of the partial y within the process row,
+// so a rank exchanges O(N / sqrt(P)) values instead of O(N). Include after
+// mpi.h.
+#include <stdlib.h>
+#include <string.h>
+#include "formats.h"
+#include "dist_input.h"
+
+typedef struct checkerboard
+{
+    int pr, pc;  //grid shape
+    int my_row, my_col;  //this rank's grid coordinates
+    MPI_Comm row_comm;  //ranks of this process row, ordered by column
+    MPI_Comm col_comm;  //ranks of this process column, ordered by row
+    int *row_offsets;  //pr + 1 row block boundaries
+    int *col_offsets;  //pc + 1 column block boundaries
+    int rstart, rcount, cstart, ccount;  //this rank's block
+    coo_matrix A;  //local block, indices relative to the block
+    int *x_counts, *x_displs;  //pieces of the column block, per rank of col_comm
+    int *y_counts, *y_displs;  //pieces of the row block, per rank of row_comm
+    int x_start, x_count;  //this rank's x piece (global indices)
+    int y_start, y_count;  //this rank's y piece (global indices)
+    float *x_block;  //expanded column block of x
+    float *y_block;  //partial y of the row block before the fold
+} checkerboard;
+
+// Split n values into parts near-equal pieces.
+static void split_range(int n, int parts, int *counts, int *displs)
+{
+    for (int p = 0; p < parts; p++)
+    {
+        int lo = (int)((long long)n * p / parts), hi = (int)((long long)n * (p + 1) / parts);
+        counts[p] = hi - lo;
+        displs[p] = lo;
+    }
+}
+
+// Build the grid and move the nonzeros of local (rows
+// [row_offsets[rank], row_offsets[rank + 1]) of a 1D layout, global column
+// indices) to their 2D owners. local is freed.
+void checkerboard_setup(coo_matrix *local, const int *row_offsets, int num_rows, int num_cols, MPI_Comm comm,
+                        checkerboard *cb)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    int dims[2] = {0, 0};
+    MPI_Dims_create(size, 2, dims);
+    cb->pr = dims[0];
+    cb->pc = dims[1];
+    cb->my_row = rank / cb->pc;
+    cb->my_col = rank % cb->pc;
+    MPI_Comm_split(comm, cb->my_row, cb->my_col, &cb->row_comm);
+    MPI_Comm_split(comm, cb->my_col, cb->my_row, &cb->col_comm);
+
+    cb->row_offsets = (int *)malloc((cb->pr + 1) * sizeof(int));
+    cb->col_offsets = (int *)malloc((cb->pc + 1) * sizeof(int));
+    block_row_offsets(num_rows, cb->pr, cb->row_offsets);
+    block_row_offsets(num_cols, cb->pc, cb->col_offsets);
+    cb->rstart = cb->row_offsets[cb->my_row];
+    cb->rcount = cb->row_offsets[cb->my_row + 1] - cb->rstart;
+    cb->cstart = cb->col_offsets[cb->my_col];
+    cb->ccount = cb->col_offsets[cb->my_col + 1] - cb->cstart;
+
+    // Owner of (r, c) is grid rank (block of r) * pc + (block of c).
+    int n = local->num_nonzeros, rstart1d = row_offsets[rank];
+    coo_entry *entries = (coo_entry *)malloc(n * sizeof(coo_entry) + 1);
+    int *dest = (int *)malloc(n * sizeof(int) + 1);
+    for (int k = 0; k < n; k++)
+    {
+        entries[k].row = local->rows[k] + rstart1d;
+        entries[k].col = local->cols[k];
+        entries[k].val = local->vals[k];
+        dest[k] = row_owner(cb->row_offsets, cb->pr, entries[k].row) * cb->pc +
+                  row_owner(cb->col_offsets, cb->pc, entries[k].col);
+    }
+    delete_coo_matrix(local);
+    int num_recv;
+    coo_entry *recv = dist_send_entries(entries, n, dest, comm, &num_recv);
+    free(dest);
+    entries_to_local_coo(recv, num_recv, cb->rstart, cb->rcount, cb->cstart, cb->ccount, &cb->A);
+
+    cb->x_counts = (int *)malloc(cb->pr * sizeof(int));
+    cb->x_displs = (int *)malloc(cb->pr * sizeof(int));
+    cb->y_counts = (int *)malloc(cb->pc * sizeof(int));
+    cb->y_displs = (int *)malloc(cb->pc * sizeof(int));
+    split_range(cb->ccount, cb->pr, cb->x_counts, cb->x_displs);
+    split_range(cb->rcount, cb->pc, cb->y_counts, cb->y_displs);
+    cb->x_start = cb->cstart + cb->x_displs[cb->my_row];
+    cb->x_count = cb->x_counts[cb->my_row];
+    cb->y_start = cb->rstart + cb->y_displs[cb->my_col];
+    cb->y_count = cb->y_counts[cb->my_col];
+
+    cb->x_block = (float *)malloc(cb->ccount * sizeof(float) + 1);
+    cb->y_block = (float *)malloc(cb->rcount * sizeof(float) + 1);
+}
+
+// Gather the column block of x from the pieces of this process column.
+void checkerboard_expand(checkerboard *cb, const float *x_piece)
+{
+    MPI_Allgatherv(x_piece, cb->x_count, MPI_FLOAT, cb->x_block, cb->x_counts, cb->x_displs, MPI_FLOAT,
+                   cb->col_comm);
+}
+
+// Sum the partial y of this process row; each rank keeps its piece.
+void checkerboard_fold(checkerboard *cb, float *y_piece)
+{
+    MPI_Reduce_scatter(cb->y_block, y_piece, cb->y_counts, MPI_FLOAT, MPI_SUM, cb->row_comm);
+}
+
+void checkerboard_free(checkerboard *cb)
+{
+    MPI_Comm_free(&cb->row_comm);
+    MPI_Comm_free(&cb->col_comm);
+    delete_coo_matrix(&cb->A);
+    free(cb->row_offsets);
+    free(cb->col_offsets);
+    free(cb->x_counts);
+    free(cb->x_displs);
+    free(cb->y_counts);
+    free(cb->y_displs);
+    free(cb->x_block);
+    free(cb->y_block);
+}
+
+// Move a vector between two contiguous distributions: this rank holds
+// [from_start, from_start + from_count) in from and receives
+// [to_start, to_start + to_count) into to. Every rank says what it holds
+// and wants; the overlaps go in one MPI_Alltoallv.
+void redistribute_range(const float *from, int from_start, int from_count, float *to, int to_start, int to_count,
+                        MPI_Comm comm)
+{
+    int size;
+    MPI_Comm_size(comm, &size);
+
+    int mine[4] = {from_start, from_count, to_start, to_count};
+    int *all = (int *)malloc(4 * size * sizeof(int));
+    MPI_Allgather(mine, 4, MPI_INT, all, 4, MPI_INT, comm);
+
+    int *send_counts = (int *)malloc(size * sizeof(int));
+    int *send_displs = (int *)malloc(size * sizeof(int));
+    int *recv_counts = (int *)malloc(size * sizeof(int));
+    int *recv_displs = (int *)malloc(size * sizeof(int));
+    for (int p = 0; p < size; p++)
+    {
+        // What p wants of ours, and what p holds of what we want.
+        int lo = from_start > all[4 * p + 2] ? from_start : all[4 * p + 2];
+        int hi = from_start + from_count < all[4 * p + 2] + all[4 * p + 3] ? from_start + from_count
+                                                                            : all[4 * p + 2] + all[4 * p + 3];
+        send_counts[p] = hi > lo ? hi - lo : 0;
+        send_displs[p] = hi > lo ? lo - from_start : 0;
+
+        lo = to_start > all[4 * p] ? to_start : all[4 * p];
+        hi = to_start + to_count < all[4 * p] + all[4 * p + 1] ? to_start + to_count : all[4 * p] + all[4 * p + 1];
+        recv_counts[p] = hi > lo ? hi - lo : 0;
+        recv_displs[p] = hi > lo ? lo - to_start : 0;
+    }
+    MPI_Alltoallv(from, send_counts, send_displs, MPI_FLOAT, to, recv_counts, recv_displs, MPI_FLOAT, comm);
+
+    free(all);
+    free(send_counts);
+    free(send_displs);
+    free(recv_counts);
+    free(recv_displs);
+}
@@ -0,0 +1,629 @@
+#pragma once
+
+// Multilevel hypergraph partitioner for the row distribution of a square
+// matrix (column-net model). Vertices are rows weighted by their nonzeros;
+// net j holds the rows with a nonzero in column j plus row j itself, whose
+// owner also owns x[j]. The connectivity-1 cut, the sum over nets of (parts
+// spanned - 1), is then exactly the number of x values the halo exchange
+// moves per SpMV.
+//
+// k parts come from recursive bisection. Cut nets are split between the two
+// halves, which keeps the k-way connectivity-1 sum exact. Each bisection is
+// multilevel: heavy-connectivity matching coarsens the hypergraph, greedy
+// growing bisects the coarsest level, and FM refinement improves the cut on
+// the way back up, subject to the part weight limits. Serial.
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MLPART_COARSEST 200  //stop coarsening at this many vertices
+#define MLPART_MATCH_MAX_NET 256  //larger nets are ignored when matching and growing
+#define MLPART_INIT_TRIES 8  //greedy-growing seeds at the coarsest level
+#define MLPART_FM_PASSES 8
+#define MLPART_FM_STALL 400  //moves without improvement before a pass gives up
+
+typedef struct hypergraph
+{
+    int nv, nn;  //vertices, nets
+    int *vwgt, *nwgt;
+    int *xpins, *pins;  //pins of net n: pins[xpins[n] .. xpins[n + 1])
+    int *xnets, *nets;  //nets of vertex v: nets[xnets[v] .. xnets[v + 1])
+} hypergraph;
+
+typedef struct mlpart_item
+{
+    int gain, v;
+} mlpart_item;
+
+// Max-heap of (gain, vertex) with lazy deletion: stale entries are skipped
+// when popped.
+typedef struct mlpart_heap
+{
+    int n, cap;
+    mlpart_item *items;
+} mlpart_heap;
+
+static void heap_push(mlpart_heap *hp, int gain, int v)
+{
+    if (hp->n == hp->cap)
+    {
+        hp->cap = hp->cap ? 2 * hp->cap : 64;
+        hp->items = (mlpart_item *)realloc(hp->items, hp->cap * sizeof(mlpart_item));
+    }
+    int i = hp->n++;
+    while (i > 0 && hp->items[(i - 1) / 2].gain < gain)
+    {
+        hp->items[i] = hp->items[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    hp->items[i].gain = gain;
+    hp->items[i].v = v;
+}
+
+static mlpart_item heap_pop(mlpart_heap *hp)
+{
+    mlpart_item top = hp->items[0], last = hp->items[--hp->n];
+    int i = 0;
+    for (;;)
+    {
+        int c = 2 * i + 1;
+        if (c >= hp->n)
+            break;
+        if (c + 1 < hp->n && hp->items[c + 1].gain > hp->items[c].gain)
+            c++;
+        if (hp->items[c].gain <= last.gain)
+            break;
+        hp->items[i] = hp->items[c];
+        i = c;
+    }
+    if (hp->n > 0)
+        hp->items[i] = last;
+    return top;
+}
+
+static unsigned int mlpart_rand(unsigned long long *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return (unsigned int)(*state >> 32);
+}
+
+static void hg_build_vertex_nets(hypergraph *h)
+{
+    int num_pins = h->xpins[h->nn];
+    h->xnets = (int *)calloc(h->nv + 1, sizeof(int));
+    h->nets = (int *)malloc(num_pins * sizeof(int) + 1);
+    for (int p = 0; p < num_pins; p++)
+        h->xnets[h->pins[p] + 1]++;
+    for (int v = 0; v < h->nv; v++)
+        h->xnets[v + 1] += h->xnets[v];
+    int *next = (int *)malloc(h->nv * sizeof(int) + 1);
+    memcpy(next, h->xnets, h->nv * sizeof(int));
+    for (int n = 0; n < h->nn; n++)
+        for (int p = h->xpins[n]; p < h->xpins[n + 1]; p++)
+            h->nets[next[h->pins[p]]++] = n;
+    free(next);
+}
+
+static void hg_free(hypergraph *h)
+{
+    free(h->vwgt);
+    free(h->nwgt);
+    free(h->xpins);
+    free(h->pins);
+    free(h->xnets);
+    free(h->nets);
+}
+
+static long long hg_total_weight(const hypergraph *h)
+{
+    long long w = 0;
+    for (int v = 0; v < h->nv; v++)
+        w += h->vwgt[v];
+    return w;
+}
+
+// Heavy-connectivity matching: vertices in random order pair with the
+// unmatched neighbour sharing the most net weight, each net counting
+// w / (|n| - 1), as long as the pair stays under max_vwgt. Builds the
+// contracted hypergraph c; cmap maps fine vertices to coarse ones. Nets
+// left with a single pin are dropped, since they can never be cut.
+static void hg_coarsen(const hypergraph *h, long long max_vwgt, unsigned long long *rng, int *cmap, hypergraph *c)
+{
+    int nv = h->nv;
+    int *order = (int *)malloc(nv * sizeof(int) + 1);
+    int *match = (int *)malloc(nv * sizeof(int) + 1);
+    int *touched = (int *)malloc(nv * sizeof(int) + 1);
+    double *score = (double *)calloc(nv + 1, sizeof(double));
+    for (int v = 0; v < nv; v++)
+    {
+        order[v] = v;
+        match[v] = -1;
+    }
+    for (int v = nv - 1; v > 0; v--)
+    {
+        int u = mlpart_rand(rng) % (v + 1), t = order[v];
+        order[v] = order[u];
+        order[u] = t;
+    }
+
+    for (int idx = 0; idx < nv; idx++)
+    {
+        int v = order[idx];
+        if (match[v] != -1)
+            continue;
+        int num_touched = 0;
+        for (int q = h->xnets[v]; q < h->xnets[v + 1]; q++)
+        {
+            int n = h->nets[q], len = h->xpins[n + 1] - h->xpins[n];
+            if (len < 2 || len > MLPART_MATCH_MAX_NET)
+                continue;
+            double s = (double)h->nwgt[n] / (len - 1);
+            for (int p = h->xpins[n]; p < h->xpins[n + 1]; p++)
+            {
+                int u = h->pins[p];
+                if (u == v || match[u] != -1)
+                    continue;
+                if (score[u] == 0)
+                    touched[num_touched++] = u;
+                score[u] += s;
+            }
+        }
+        int best = -1;
+        double best_score = 0;
+        for (int t = 0; t < num_touched; t++)
+        {
+            int u = touched[t];
+            if (score[u] > best_score && (long long)h->vwgt[u] + h->vwgt[v] <= max_vwgt)
+            {
+                best = u;
+                best_score = score[u];
+            }
+            score[u] = 0;
+        }
+        match[v] = best >= 0 ? best : v;
+        if (best >= 0)
+            match[best] = v;
+    }
+
+    int ncv = 0;
+    for (int v = 0; v < nv; v++)
+        cmap[v] = -1;
+    for (int v = 0; v < nv; v++)
+        if (cmap[v] == -1)
+        {
+            cmap[v] = ncv;
+            cmap[match[v]] = ncv++;
+        }
+
+    c->nv = ncv;
+    c->vwgt = (int *)calloc(ncv + 1, sizeof(int));
+    for (int v = 0; v < nv; v++)
+        c->vwgt[cmap[v]] += h->vwgt[v];
+
+    int *mark = (int *)malloc(ncv * sizeof(int) + 1);
+    for (int v = 0; v < ncv; v++)
+        mark[v] = -1;
+    c->xpins = (int *)malloc((h->nn + 1) * sizeof(int));
+    c->pins = (int *)malloc(h->xpins[h->nn] * sizeof(int) + 1);
+    c->nwgt = (int *)malloc(h->nn * sizeof(int) + 1);
+    int nn = 0, num_pins = 0;
+    c->xpins[0] = 0;
+    for (int n = 0; n < h->nn; n++)
+    {
+        int start = num_pins;
+        for (int p = h->xpins[n]; p < h->xpins[n + 1]; p++)
+        {
+            int cu = cmap[h->pins[p]];
+            if (mark[cu] != n)
+            {
+                mark[cu] = n;
+                c->pins[num_pins++] = cu;
+            }
+        }
+        if (num_pins - start < 2)
+        {
+            num_pins = start;
+            continue;
+        }
+        c->nwgt[nn] = h->nwgt[n];
+        c->xpins[++nn] = num_pins;
+    }
+    c->nn = nn;
+    hg_build_vertex_nets(c);
+
+    free(order);
+    free(match);
+    free(touched);
+    free(score);
+    free(mark);
+}
+
+// Weight above the limit on either side; 0 when balanced.
+static long long side_violation(const long long *w, const long long *max_w)
+{
+    return (w[0] > max_w[0] ? w[0] - max_w[0] : 0) + (w[1] > max_w[1] ? w[1] - max_w[1] : 0);
+}
+
+// Pins of every net on each side, side weights and cut weight.
+static long long fm_counts(const hypergraph *h, const int *side, int *cnt, long long *w)
+{
+    long long cut = 0;
+    w[0] = w[1] = 0;
+    for (int v = 0; v < h->nv; v++)
+        w[side[v]] += h->vwgt[v];
+    for (int n = 0; n < h->nn; n++)
+    {
+        cnt[2 * n] = cnt[2 * n + 1] = 0;
+        for (int p = h->xpins[n]; p < h->xpins[n + 1]; p++)
+            cnt[2 * n + side[h->pins[p]]]++;
+        if (cnt[2 * n] > 0 && cnt[2 * n + 1] > 0)
+            cut += h->nwgt[n];
+    }
+    return cut;
+}
+
+static void fm_bump(mlpart_heap *heaps, int *gain, const int *side, int u, int delta)
+{
+    gain[u] += delta;
+    heap_push(&heaps[side[u]], gain[u], u);
+}
+
+// Fiduccia-Mattheyses passes on a bisection. A move must keep the target
+// side under its limit unless it lightens an overweight side. Each pass
+// keeps the best prefix of its moves (least violation, then least cut).
+// Returns the cut.
+static long long fm_refine(const hypergraph *h, int *side, const long long *max_w)
+{
+    int nv = h->nv;
+    int *cnt = (int *)malloc(2 * h->nn * sizeof(int) + 1);
+    int *gain = (int *)malloc(nv * sizeof(int) + 1);
+    int *moves = (int *)malloc(nv * sizeof(int) + 1);
+    char *locked = (char *)malloc(nv + 1);
+    mlpart_heap heaps[2] = {{0, 0, NULL}, {0, 0, NULL}};
+    long long w[2];
+    long long cut = fm_counts(h, side, cnt, w);
+
+    for (int pass = 0; pass < MLPART_FM_PASSES; pass++)
+    {
+        heaps[0].n = heaps[1].n = 0;
+        for (int v = 0; v < nv; v++)
+        {
+            int s = side[v];
+            gain[v] = 0;
+            for (int q = h->xnets[v]; q < h->xnets[v + 1]; q++)
+            {
+                int n = h->nets[q];
+                if (cnt[2 * n + s] == 1)
+                    gain[v] += h->nwgt[n];
+                if (cnt[2 * n + 1 - s] == 0)
+                    gain[v] -= h->nwgt[n];
+            }
+            locked[v] = 0;
+            heap_push(&heaps[s], gain[v], v);
+        }
+
+        long long start_cut = cut, start_violation = side_violation(w, max_w);
+        long long cur = cut, best = cut, best_violation = start_violation;
+        int num_moves = 0, best_moves = 0, stall = 0;
+        for (;;)
+        {
+            // Best feasible move out of each side.
+            int cand[2] = {-1, -1};
+            for (int s = 0; s < 2; s++)
+                while (heaps[s].n > 0)
+                {
+                    mlpart_item top = heaps[s].items[0];
+                    int v = top.v;
+                    if (locked[v] || side[v] != s || top.gain != gain[v])
+                    {
+                        heap_pop(&heaps[s]);
+                        continue;
+                    }
+                    if (w[1 - s] + h->vwgt[v] > max_w[1 - s] && w[s] <= max_w[s])
+                    {
+                        heap_pop(&heaps[s]);  //does not fit this pass
+                        locked[v] = 1;
+                        continue;
+                    }
+                    cand[s] = v;
+                    break;
+                }
+            if (cand[0] < 0 && cand[1] < 0)
+                break;
+            int f = cand[1] < 0 || (cand[0] >= 0 && gain[cand[0]] >= gain[cand[1]]) ? 0 : 1, t = 1 - f;
+            int v = cand[f];
+            heap_pop(&heaps[f]);
+            locked[v] = 1;
+
+            for (int q = h->xnets[v]; q < h->xnets[v + 1]; q++)
+            {
+                int n = h->nets[q], nw = h->nwgt[n];
+                if (cnt[2 * n + t] == 0)
+                {
+                    for (int p = h->xpins[n]; p < h->xpins[n + 1]; p++)
+                        if (!locked[h->pins[p]])
+                            fm_bump(heaps, gain, side, h->pins[p], nw);
+                }
+                else if (cnt[2 * n + t] == 1)
+                {
+                    for (int p = h->xpins[n]; p < h->xpins[n + 1]; p++)
+                        if (!locked[h->pins[p]] && side[h->pins[p]] == t)
+                            fm_bump(heaps, gain, side, h->pins[p], -nw);
+                }
+                cnt[2 * n + f]--;
+                cnt[2 * n + t]++;
+                if (cnt[2 * n + f] == 0)
+                {
+                    for (int p = h->xpins[n]; p < h->xpins[n + 1]; p++)
+                        if (!locked[h->pins[p]])
+                            fm_bump(heaps, gain, side, h->pins[p], -nw);
+                }
+                else if (cnt[2 * n + f] == 1)
+                {
+                    for (int p = h->xpins[n]; p < h->xpins[n + 1]; p++)
+                        if (!locked[h->pins[p]] && side[h->pins[p]] == f)
+                            fm_bump(heaps, gain, side, h->pins[p], nw);
+                }
+            }
+            cur -= gain[v];
+            side[v] = t;
+            w[f] -= h->vwgt[v];
+            w[t] += h->vwgt[v];
+            moves[num_moves++] = v;
+
+            long long violation = side_violation(w, max_w);
+            if (violation < best_violation || (violation == best_violation && cur < best))
+            {
+                best = cur;
+                best_violation = violation;
+                best_moves = num_moves;
+                stall = 0;
+            }
+            else if (++stall > MLPART_FM_STALL)
+                break;
+        }
+
+        for (int m = num_moves - 1; m >= best_moves; m--)
+            side[moves[m]] = 1 - side[moves[m]];
+        cut = fm_counts(h, side, cnt, w);
+        if (best_violation >= start_violation && cut >= start_cut)
+            break;
+    }
+
+    free(cnt);
+    free(gain);
+    free(moves);
+    free(locked);
+    free(heaps[0].items);
+    free(heaps[1].items);
+    return cut;
+}
+
+// Greedy growing: side 0 grows breadth-first through small nets from a
+// random seed until it reaches target0; the best of several seeds after FM
+// is kept.
+static void initial_bisection(const hypergraph *h, const long long *max_w, long long target0,
+                              unsigned long long *rng, int *side)
+{
+    int nv = h->nv;
+    int *trial = (int *)malloc(nv * sizeof(int) + 1);
+    int *queue = (int *)malloc(nv * sizeof(int) + 1);
+    char *seen = (char *)malloc(nv + 1);
+    long long best_cut = -1, best_violation = 0;
+
+    for (int t = 0; t < MLPART_INIT_TRIES; t++)
+    {
+        for (int v = 0; v < nv; v++)
+        {
+            trial[v] = 1;
+            seen[v] = 0;
+        }
+        long long w0 = 0;
+        int head = 0, tail = 0, scan = nv > 0 ? mlpart_rand(rng) % nv : 0, scanned = 0;
+        while (w0 < target0)
+        {
+            if (head == tail)
+            {
+                while (scanned < nv && seen[scan])
+                {
+                    scan = (scan + 1) % nv;
+                    scanned++;
+                }
+                if (scanned == nv)
+                    break;
+                seen[scan] = 1;
+                queue[tail++] = scan;
+            }
+            int v = queue[head++];
+            trial[v] = 0;
+            w0 += h->vwgt[v];
+            for (int q = h->xnets[v]; q < h->xnets[v + 1]; q++)
+            {
+                int n = h->nets[q];
+                if (h->xpins[n + 1] - h->xpins[n] > MLPART_MATCH_MAX_NET)
+                    continue;
+                for (int p = h->xpins[n]; p < h->xpins[n + 1]; p++)
+                    if (!seen[h->pins[p]])
+                    {
+                        seen[h->pins[p]] = 1;
+                        queue[tail++] = h->pins[p];
+                    }
+            }
+        }
+
+        long long cut = fm_refine(h, trial, max_w), w[2] = {0, 0};
+        for (int v = 0; v < nv; v++)
+            w[trial[v]] += h->vwgt[v];
+        long long violation = side_violation(w, max_w);
+        if (best_cut < 0 || violation < best_violation || (violation == best_violation && cut < best_cut))
+        {
+            best_cut = cut;
+            best_violation = violation;
+            memcpy(side, trial, nv * sizeof(int));
+        }
+    }
+
+    free(trial);
+    free(queue);
+    free(seen);
+}
+
+static void ml_bisect(const hypergraph *h, const long long *max_w, long long target0, unsigned long long *rng,
+                      int *side)
+{
+    if (h->nv <= MLPART_COARSEST)
+    {
+        initial_bisection(h, max_w, target0, rng, side);
+        return;
+    }
+
+    hypergraph c;
+    int *cmap = (int *)malloc(h->nv * sizeof(int));
+    long long max_vwgt = hg_total_weight(h) / MLPART_COARSEST + 1;
+    hg_coarsen(h, max_vwgt, rng, cmap, &c);
+    if (c.nv > 0.95 * h->nv)  //matching has stalled
+    {
+        hg_free(&c);
+        free(cmap);
+        initial_bisection(h, max_w, target0, rng, side);
+        return;
+    }
+
+    int *cside = (int *)malloc(c.nv * sizeof(int) + 1);
+    ml_bisect(&c, max_w, target0, rng, cside);
+    for (int v = 0; v < h->nv; v++)
+        side[v] = cside[cmap[v]];
+    fm_refine(h, side, max_w);
+
+    free(cside);
+    free(cmap);
+    hg_free(&c);
+}
+
+// The vertices on side s and the nets restricted to them (cut nets split).
+// ids[v] of the sub-hypergraph is the original vertex id.
+static void hg_side(const hypergraph *h, const int *ids, const int *side, int s, hypergraph *sub, int *sub_ids)
+{
+    int *newid = (int *)malloc(h->nv * sizeof(int) + 1);
+    sub->nv = 0;
+    for (int v = 0; v < h->nv; v++)
+        if (side[v] == s)
+        {
+            sub_ids[sub->nv] = ids[v];
+            newid[v] = sub->nv++;
+        }
+    sub->vwgt = (int *)malloc(sub->nv * sizeof(int) + 1);
+    for (int v = 0; v < h->nv; v++)
+        if (side[v] == s)
+            sub->vwgt[newid[v]] = h->vwgt[v];
+
+    sub->xpins = (int *)malloc((h->nn + 1) * sizeof(int));
+    sub->pins = (int *)malloc(h->xpins[h->nn] * sizeof(int) + 1);
+    sub->nwgt = (int *)malloc(h->nn * sizeof(int) + 1);
+    int nn = 0, num_pins = 0;
+    sub->xpins[0] = 0;
+    for (int n = 0; n < h->nn; n++)
+    {
+        int start = num_pins;
+        for (int p = h->xpins[n]; p < h->xpins[n + 1]; p++)
+            if (side[h->pins[p]] == s)
+                sub->pins[num_pins++] = newid[h->pins[p]];
+        if (num_pins - start < 2)
+        {
+            num_pins = start;
+            continue;
+        }
+        sub->nwgt[nn] = h->nwgt[n];
+        sub->xpins[++nn] = num_pins;
+    }
+    sub->nn = nn;
+    hg_build_vertex_nets(sub);
+    free(newid);
+}
+
+static void ml_recurse(const hypergraph *h, const int *ids, int k, int first_part, double eps,
+                       unsigned long long *rng, int *part)
+{
+    if (k == 1 || h->nv == 0)
+    {
+        for (int v = 0; v < h->nv; v++)
+            part[ids[v]] = first_part;
+        return;
+    }
+
+    int k0 = k / 2;
+    long long total = hg_total_weight(h);
+    long long target[2] = {total * k0 / k, total - total * k0 / k};
+    long long max_w[2] = {(long long)ceil(target[0] * (1 + eps)), (long long)ceil(target[1] * (1 + eps))};
+    int *side = (int *)malloc(h->nv * sizeof(int));
+    ml_bisect(h, max_w, target[0], rng, side);
+
+    for (int s = 0; s < 2; s++)
+    {
+        hypergraph sub;
+        int *sub_ids = (int *)malloc(h->nv * sizeof(int));
+        hg_side(h, ids, side, s, &sub, sub_ids);
+        ml_recurse(&sub, sub_ids, s == 0 ? k0 : k - k0, s == 0 ? first_part : first_part + k0, eps, rng, part);
+        hg_free(&sub);
+        free(sub_ids);
+    }
+    free(side);
+}
+
+// Sum over nets of (parts spanned - 1).
+long long mlpart_volume(int nn, const int *xpins, const int *pins, const int *part, int k)
+{
+    int *mark = (int *)malloc(k * sizeof(int));
+    for (int p = 0; p < k; p++)
+        mark[p] = -1;
+    long long volume = 0;
+    for (int n = 0; n < nn; n++)
+    {
+        int spanned = 0;
+        for (int q = xpins[n]; q < xpins[n + 1]; q++)
+            if (mark[part[pins[q]]] != n)
+            {
+                mark[part[pins[q]]] = n;
+                spanned++;
+            }
+        volume += spanned > 1 ? spanned - 1 : 0;
+    }
+    free(mark);
+    return volume;
+}
+
+// Split nv vertices into k parts whose weights stay within (1 + eps) of
+// equal, minimising the connectivity-1 cut of the nets (xpins, pins; pins
+// of a net must be distinct). Writes part[v] and returns the cut.
+long long mlpart_partition(int nv, int nn, const int *xpins, const int *pins, const int *vwgt, int k, double eps,
+                           int *part)
+{
+    hypergraph h;
+    h.nv = nv;
+    h.nn = nn;
+    h.vwgt = (int *)malloc(nv * sizeof(int) + 1);
+    h.nwgt = (int *)malloc(nn * sizeof(int) + 1);
+    h.xpins = (int *)malloc((nn + 1) * sizeof(int));
+    h.pins = (int *)malloc(xpins[nn] * sizeof(int) + 1);
+    memcpy(h.vwgt, vwgt, nv * sizeof(int));
+    memcpy(h.xpins, xpins, (nn + 1) * sizeof(int));
+    memcpy(h.pins, pins, xpins[nn] * sizeof(int));
+    for (int n = 0; n < nn; n++)
+        h.nwgt[n] = 1;
+    hg_build_vertex_nets(&h);
+
+    int *ids = (int *)malloc(nv * sizeof(int) + 1);
+    for (int v = 0; v < nv; v++)
+        ids[v] = v;
+    // Imbalance compounds over the levels of bisection.
+    int levels = (int)ceil(log2(k > 1 ? k : 2));
+    double level_eps = pow(1 + eps, 1.0 / levels) - 1;
+    unsigned long long rng = 0x9E3779B97F4A7C15ULL;
+    ml_recurse(&h, ids, k, 0, level_eps, &rng, part);
+
+    free(ids);
+    hg_free(&h);
+    return mlpart_volume(nn, xpins, pins, part, k);
+}
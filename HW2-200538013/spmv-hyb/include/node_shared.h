@@ -0,0 +1,192 @@
+#pragma once
+
+// One copy of x per node for the hybrid SpMV. The ranks of a node
+// (MPI_Comm_split_type with MPI_COMM_TYPE_SHARED) allocate one
+// MPI_Win_allocate_shared window. Each rank's segment holds its owned slice
+// of x followed by its share of the node's ghosts: the distinct columns some
+// rank of the node references but no rank of the node owns. Every ghost is
+// fetched once per node, by the rank whose share it falls in, with an
+// ordinary halo plan (its segment is laid out exactly like a halo-layout x).
+// All ranks and their threads then read the whole node's x with plain loads;
+// nothing moves between ranks of the same node. Include after mpi.h.
+#include <stdio.h>
+#include <stdlib.h>
+#include "formats.h"
+#include "dist_input.h"
+#include "halo.h"
+
+typedef struct node_x
+{
+    MPI_Comm node_comm;  //ranks sharing this window, ordered by world rank
+    int node_rank, node_size;
+    MPI_Win win;
+    float *base;  //start of the first non-empty segment; A's columns index from here
+    float *segment;  //this rank's segment: owned slice, then its ghost share
+    int num_node_ghosts;  //distinct off-node columns of the whole node
+    halo_plan plan;  //fetches this rank's ghost share from the off-node owners
+} node_x;
+
+// Set up the window for A (this rank's rows, global column indices; x
+// distributed by col_offsets) and write A's columns as offsets from base
+// into node_cols. ranks_per_node > 0 splits the shared-memory communicator
+// further into groups of that many ranks (one window per socket, say).
+void node_x_setup(const coo_matrix *A, const int *col_offsets, int ranks_per_node, MPI_Comm comm, node_x *nx,
+                  int *node_cols)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    MPI_Comm shared;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &shared);
+    if (ranks_per_node > 0)
+    {
+        int shared_rank;
+        MPI_Comm_rank(shared, &shared_rank);
+        MPI_Comm_split(shared, shared_rank / ranks_per_node, shared_rank, &nx->node_comm);
+        MPI_Comm_free(&shared);
+    }
+    else
+        nx->node_comm = shared;
+    MPI_Comm_rank(nx->node_comm, &nx->node_rank);
+    MPI_Comm_size(nx->node_comm, &nx->node_size);
+    int node_size = nx->node_size;
+
+    // Node rank of every world rank on this node, -1 elsewhere.
+    int *members = (int *)malloc(node_size * sizeof(int));
+    int *node_rank_of = (int *)malloc(size * sizeof(int));
+    MPI_Allgather(&rank, 1, MPI_INT, members, 1, MPI_INT, nx->node_comm);
+    for (int p = 0; p < size; p++)
+        node_rank_of[p] = -1;
+    for (int r = 0; r < node_size; r++)
+        node_rank_of[members[r]] = r;
+
+    // The node's ghosts: our off-node columns, merged over the node.
+    int n = 0;
+    int *mine = (int *)malloc(A->num_nonzeros * sizeof(int) + 1);
+    for (int k = 0; k < A->num_nonzeros; k++)
+        if (node_rank_of[row_owner(col_offsets, size, A->cols[k])] < 0)
+            mine[n++] = A->cols[k];
+    n = sort_unique_ints(mine, n);
+    int *counts = (int *)malloc(node_size * sizeof(int));
+    int *displs = (int *)malloc(node_size * sizeof(int));
+    MPI_Allgather(&n, 1, MPI_INT, counts, 1, MPI_INT, nx->node_comm);
+    int total = 0;
+    for (int r = 0; r < node_size; r++)
+    {
+        displs[r] = total;
+        total += counts[r];
+    }
+    int *node_ghosts = (int *)malloc(total * sizeof(int) + 1);
+    MPI_Allgatherv(mine, n, MPI_INT, node_ghosts, counts, displs, MPI_INT, nx->node_comm);
+    free(mine);
+    int num_node_ghosts = sort_unique_ints(node_ghosts, total);
+    nx->num_node_ghosts = num_node_ghosts;
+
+    // Contiguous shares of the node's ghosts, one per node rank.
+    int *share_offsets = (int *)malloc((node_size + 1) * sizeof(int));
+    block_row_offsets(num_node_ghosts, node_size, share_offsets);
+    int share_start = share_offsets[nx->node_rank];
+    int share_count = share_offsets[nx->node_rank + 1] - share_start;
+    int *share = (int *)malloc(share_count * sizeof(int) + 1);
+    memcpy(share, node_ghosts + share_start, share_count * sizeof(int));
+    halo_setup_ghosts(share, share_count, col_offsets, comm, &nx->plan);
+
+    MPI_Aint segment_size = (MPI_Aint)(nx->plan.num_owned + share_count) * sizeof(float);
+    MPI_Win_allocate_shared(segment_size, sizeof(float), MPI_INFO_NULL, nx->node_comm, &nx->segment, &nx->win);
+    MPI_Aint query_size;
+    int disp_unit;
+    float *node_base;
+    MPI_Win_shared_query(nx->win, MPI_PROC_NULL, &query_size, &disp_unit, &node_base);
+    nx->base = node_base;
+    // Passive target for the whole run; MPI_Win_sync plus a node barrier
+    // orders the writes and reads of each SpMV.
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, nx->win);
+
+    // Where every node rank's segment starts, relative to base.
+    long long *segment_offsets = (long long *)malloc(node_size * sizeof(long long));
+    for (int r = 0; r < node_size; r++)
+    {
+        float *r_segment;
+        MPI_Win_shared_query(nx->win, r, &query_size, &disp_unit, &r_segment);
+        segment_offsets[r] = query_size > 0 ? r_segment - node_base : 0;
+    }
+
+    for (int k = 0; k < A->num_nonzeros; k++)
+    {
+        int j = A->cols[k];
+        int owner = row_owner(col_offsets, size, j);
+        if (node_rank_of[owner] >= 0)
+            node_cols[k] = (int)(segment_offsets[node_rank_of[owner]] + j - col_offsets[owner]);
+        else
+        {
+            int g = (int)((int *)bsearch(&j, node_ghosts, num_node_ghosts, sizeof(int), cmp_halo_ints) - node_ghosts);
+            int r = row_owner(share_offsets, node_size, g);
+            node_cols[k] = (int)(segment_offsets[r] + col_offsets[members[r] + 1] - col_offsets[members[r]] + g -
+                                 share_offsets[r]);
+        }
+    }
+
+    free(members);
+    free(node_rank_of);
+    free(counts);
+    free(displs);
+    free(node_ghosts);
+    free(share_offsets);
+    free(segment_offsets);
+}
+
+// Make the node's x readable: fetch our ghost share from the off-node owners
+// (our owned slice must be written), then publish to and wait for the rest
+// of the node.
+void node_x_update(node_x *nx)
+{
+    halo_exchange(&nx->plan, nx->segment);
+    MPI_Win_sync(nx->win);
+    MPI_Barrier(nx->node_comm);
+    MPI_Win_sync(nx->win);
+}
+
+void node_x_free(node_x *nx)
+{
+    halo_free(&nx->plan);
+    MPI_Win_unlock_all(nx->win);
+    MPI_Win_free(&nx->win);
+    MPI_Comm_free(&nx->node_comm);
+}
+
+// x entries held per node against one halo-layout copy per rank, and the
+// entries that still cross node boundaries, printed on rank 0.
+void node_x_report(const node_x *nx, const coo_matrix *A, const int *col_offsets, MPI_Comm comm)
+{
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    int cstart = col_offsets[rank], cend = col_offsets[rank + 1];
+
+    // What this rank would hold on its own: owned slice plus every ghost.
+    int n = 0;
+    int *remote = (int *)malloc(A->num_nonzeros * sizeof(int) + 1);
+    for (int k = 0; k < A->num_nonzeros; k++)
+        if (A->cols[k] < cstart || A->cols[k] >= cend)
+            remote[n++] = A->cols[k];
+    n = sort_unique_ints(remote, n);
+    free(remote);
+
+    // Summed over the node: x entries in the window and in per-rank copies.
+    long long node_sizes[2] = {cend - cstart, cend - cstart + n};
+    MPI_Allreduce(MPI_IN_PLACE, node_sizes, 2, MPI_LONG_LONG, MPI_SUM, nx->node_comm);
+    node_sizes[0] += nx->num_node_ghosts;
+    long long most[3] = {node_sizes[0], node_sizes[1], nx->node_size}, most_all[3];
+    MPI_Reduce(most, most_all, 3, MPI_LONG_LONG, MPI_MAX, 0, comm);
+
+    // Nodes, entries fetched across nodes, and what private halos would move.
+    long long mine[3] = {nx->node_rank == 0, nx->plan.num_ghosts, n}, totals[3];
+    MPI_Reduce(mine, totals, 3, MPI_LONG_LONG, MPI_SUM, 0, comm);
+    if (rank == 0)
+    {
+        printf("Node-shared x: %lld nodes of up to %lld ranks; x entries per node max %lld "
+               "(one halo-layout copy per rank: %lld)\n",
+               totals[0], most_all[2], most_all[0], most_all[1]);
+        printf("\tx entries moved per SpMV: %lld across nodes (per-rank halo: %lld)\n", totals[1], totals[2]);
+    }
+}
@@ -0,0 +1,351 @@
+#pragma once
+
+// Contiguous row partitions for the distributed SpMV. Every strategy gives
+// each row a weight and cuts the rows into one block per rank with nearly
+// equal total weight (each cut is within half a row of its target). A rank
+// only knows the weights of the rows it owns, so the cuts are found from a
+// prefix sum over ranks and no rank ever holds per-row data for the whole
+// matrix. Include after mpi.h.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "formats.h"
+#include "dist_input.h"
+#include "mlpart.h"
+
+typedef enum partition_kind
+{
+    PARTITION_ROWS,  //equal row counts
+    PARTITION_NNZ,  //equal nonzero counts
+    PARTITION_WEIGHTED,  //nonzeros plus a cost per distinct remote column
+    PARTITION_FEEDBACK,  //nonzeros scaled by each rank's measured SpMV rate
+    PARTITION_HYPERGRAPH,  //rows renumbered by the multilevel partitioner (mlpart.h)
+    PARTITION_NUM_KINDS
+} partition_kind;
+
+const char *partition_names[PARTITION_NUM_KINDS] = {"rows", "nnz", "weighted", "feedback", "hypergraph"};
+
+// Cost of one distinct remote column (an x value received and unpacked)
+// relative to one nonzero, for the weighted split.
+#define PARTITION_REMOTE_COST 2.0
+// Measure-and-recut rounds of the feedback split.
+#define PARTITION_FEEDBACK_ROUNDS 2
+// Allowed nonzero imbalance of the hypergraph split.
+#define PARTITION_IMBALANCE 0.03
+
+typedef struct partition_options
+{
+    partition_kind kind;
+    double remote_cost;  //weighted
+    int rounds;  //feedback
+    double imbalance;  //hypergraph
+} partition_options;
+
+// Parse "kind[,param]" from --partition; NULL means rows. The parameter is
+// the remote column cost for weighted, the round count for feedback and the
+// allowed imbalance for hypergraph. Returns 0 for an unknown kind.
+int parse_partition(const char *text, partition_options *part)
+{
+    part->kind = PARTITION_ROWS;
+    part->remote_cost = PARTITION_REMOTE_COST;
+    part->rounds = PARTITION_FEEDBACK_ROUNDS;
+    part->imbalance = PARTITION_IMBALANCE;
+    if (text == NULL)
+        return 1;
+
+    const char *comma = strchr(text, ',');
+    size_t len = comma ? (size_t)(comma - text) : strlen(text);
+    for (int k = 0; k < PARTITION_NUM_KINDS; k++)
+        if (strlen(partition_names[k]) == len && strncmp(text, partition_names[k], len) == 0)
+        {
+            part->kind = (partition_kind)k;
+            if (comma && part->kind == PARTITION_WEIGHTED)
+                part->remote_cost = atof(comma + 1);
+            if (comma && part->kind == PARTITION_FEEDBACK)
+                part->rounds = atoi(comma + 1) > 0 ? atoi(comma + 1) : 1;
+            if (comma && part->kind == PARTITION_HYPERGRAPH)
+                part->imbalance = atof(comma + 1);
+            return 1;
+        }
+    return 0;
+}
+
+// weight[i] = nonzeros in local row i.
+void row_nnz_weights(const coo_matrix *local, double *weight)
+{
+    for (int i = 0; i < local->num_rows; i++)
+        weight[i] = 0;
+    for (int k = 0; k < local->num_nonzeros; k++)
+        weight[local->rows[k]] += 1;
+}
+
+// Distinct columns outside [rstart, rstart + num_rows) referenced by the
+// local rows, i.e. the x entries another rank owns. If weight is not NULL,
+// cost is added to the first row (in storage order) that references each.
+int count_remote_columns(const coo_matrix *local, int rstart, double *weight, double cost)
+{
+    char *seen = (char *)calloc(local->num_cols + 1, 1);
+    int remote = 0, rend = rstart + local->num_rows;
+    for (int k = 0; k < local->num_nonzeros; k++)
+    {
+        int j = local->cols[k];
+        if ((j >= rstart && j < rend) || seen[j])
+            continue;
+        seen[j] = 1;
+        remote++;
+        if (weight)
+            weight[local->rows[k]] += cost;
+    }
+    free(seen);
+    return remote;
+}
+
+// Cut num_rows rows into size blocks of nearly equal weight. This rank
+// holds the weights of rows [rstart, rstart + rcount); all ranks get the
+// same row_offsets (size + 1 entries). The cut before block p is the first
+// row whose midpoint reaches p / size of the total weight.
+void weighted_row_offsets(const double *weight, int rstart, int rcount, int num_rows, MPI_Comm comm,
+                          int *row_offsets)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    double local_total = 0, before = 0, total;
+    for (int i = 0; i < rcount; i++)
+        local_total += weight[i];
+    MPI_Exscan(&local_total, &before, 1, MPI_DOUBLE, MPI_SUM, comm);
+    if (rank == 0)
+        before = 0;
+    MPI_Allreduce(&local_total, &total, 1, MPI_DOUBLE, MPI_SUM, comm);
+    if (total <= 0)
+    {
+        block_row_offsets(num_rows, size, row_offsets);
+        return;
+    }
+
+    int *cuts = (int *)malloc((size + 1) * sizeof(int));
+    for (int p = 0; p <= size; p++)
+        cuts[p] = num_rows;
+    int p = 1;
+    for (int i = 0; i < rcount && p < size; i++)
+    {
+        while (p < size && before + 0.5 * weight[i] >= total * p / size)
+            cuts[p++] = rstart + i;
+        before += weight[i];
+    }
+    MPI_Allreduce(cuts, row_offsets, size + 1, MPI_INT, MPI_MIN, comm);
+    row_offsets[0] = 0;
+    row_offsets[size] = num_rows;
+    free(cuts);
+}
+
+// Move the local rows (owned under old_offsets) to their owners under
+// new_offsets. local is rebuilt sorted by row with local row indices.
+void repartition_rows(coo_matrix *local, const int *old_offsets, const int *new_offsets, MPI_Comm comm)
+{
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    int rstart = old_offsets[rank], num_cols = local->num_cols;
+
+    coo_entry *entries = (coo_entry *)malloc(local->num_nonzeros * sizeof(coo_entry) + 1);
+    for (int k = 0; k < local->num_nonzeros; k++)
+    {
+        entries[k].row = local->rows[k] + rstart;
+        entries[k].col = local->cols[k];
+        entries[k].val = local->vals[k];
+    }
+    int n = local->num_nonzeros;
+    delete_coo_matrix(local);
+    dist_exchange_entries(entries, n, new_offsets, num_cols, comm, local);
+}
+
+// Gather the sparsity pattern on rank 0, partition the rows of the square
+// matrix with mlpart_partition and number them part by part. perm[i] is the
+// new index of row (and column) i and new_offsets the part boundaries; both
+// are broadcast. Returns the predicted halo volume (x entries moved per
+// SpMV); *block_volume is the same measure for the current row_offsets.
+long long hypergraph_row_permutation(const coo_matrix *local, const int *row_offsets, int num_rows, double imbalance,
+                                     MPI_Comm comm, int *perm, int *new_offsets, long long *block_volume)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int rstart = row_offsets[rank];
+
+    int n = 2 * local->num_nonzeros;
+    int *pairs = (int *)malloc(n * sizeof(int) + 1);
+    for (int k = 0; k < local->num_nonzeros; k++)
+    {
+        pairs[2 * k] = local->rows[k] + rstart;
+        pairs[2 * k + 1] = local->cols[k];
+    }
+    int *counts = NULL, *displs = NULL, *all = NULL, total = 0;
+    if (rank == 0)
+    {
+        counts = (int *)malloc(size * sizeof(int));
+        displs = (int *)malloc(size * sizeof(int));
+    }
+    MPI_Gather(&n, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+    if (rank == 0)
+    {
+        for (int p = 0; p < size; p++)
+        {
+            displs[p] = total;
+            total += counts[p];
+        }
+        all = (int *)malloc(total * sizeof(int) + 1);
+    }
+    MPI_Gatherv(pairs, n, MPI_INT, all, counts, displs, MPI_INT, 0, comm);
+    free(pairs);
+
+    long long volumes[2];
+    if (rank == 0)
+    {
+        // Column nets: the rows of column j, and row j as the owner of x[j].
+        int nnz = total / 2;
+        int *vwgt = (int *)calloc(num_rows + 1, sizeof(int));
+        int *xpins = (int *)calloc(num_rows + 1, sizeof(int));
+        for (int k = 0; k < nnz; k++)
+        {
+            vwgt[all[2 * k]]++;
+            xpins[all[2 * k + 1] + 1]++;
+        }
+        for (int j = 0; j < num_rows; j++)
+            xpins[j + 1] += xpins[j] + 1;
+        int *pins = (int *)malloc(xpins[num_rows] * sizeof(int) + 1);
+        int *next = (int *)malloc(num_rows * sizeof(int) + 1);
+        for (int j = 0; j < num_rows; j++)
+        {
+            pins[xpins[j]] = j;
+            next[j] = xpins[j] + 1;
+        }
+        for (int k = 0; k < nnz; k++)
+            pins[next[all[2 * k + 1]]++] = all[2 * k];
+        free(all);
+
+        // Drop repeated pins (the diagonal, duplicate entries).
+        int *mark = next, num_pins = 0;
+        for (int j = 0; j < num_rows; j++)
+            mark[j] = -1;
+        for (int j = 0, start = 0; j < num_rows; j++)
+        {
+            int end = xpins[j + 1];
+            xpins[j] = num_pins;
+            for (int q = start; q < end; q++)
+                if (mark[pins[q]] != j)
+                {
+                    mark[pins[q]] = j;
+                    pins[num_pins++] = pins[q];
+                }
+            start = end;
+        }
+        xpins[num_rows] = num_pins;
+
+        int *part = (int *)malloc(num_rows * sizeof(int) + 1);
+        for (int i = 0; i < num_rows; i++)
+            part[i] = row_owner(row_offsets, size, i);
+        volumes[1] = mlpart_volume(num_rows, xpins, pins, part, size);
+        volumes[0] = mlpart_partition(num_rows, num_rows, xpins, pins, vwgt, size, imbalance, part);
+
+        // Number the rows part by part, keeping their order within a part.
+        for (int p = 0; p <= size; p++)
+            new_offsets[p] = 0;
+        for (int i = 0; i < num_rows; i++)
+            new_offsets[part[i] + 1]++;
+        for (int p = 0; p < size; p++)
+            new_offsets[p + 1] += new_offsets[p];
+        memcpy(next, new_offsets, size * sizeof(int));
+        for (int i = 0; i < num_rows; i++)
+            perm[i] = next[part[i]]++;
+
+        free(vwgt);
+        free(xpins);
+        free(pins);
+        free(next);
+        free(part);
+        free(counts);
+        free(displs);
+    }
+    MPI_Bcast(perm, num_rows, MPI_INT, 0, comm);
+    MPI_Bcast(new_offsets, size + 1, MPI_INT, 0, comm);
+    MPI_Bcast(volumes, 2, MPI_LONG_LONG, 0, comm);
+    *block_volume = volumes[1];
+    return volumes[0];
+}
+
+// 1 if perm maps [0, n) onto itself one to one. The reference product is
+// renumbered by the same perm, so a numbering that merges or drops rows
+// would otherwise pass verification.
+int is_permutation(const int *perm, int n)
+{
+    char *hit = (char *)calloc(n + 1, sizeof(char));
+    int ok = 1;
+    for (int i = 0; i < n && ok; i++)
+    {
+        ok = perm[i] >= 0 && perm[i] < n && !hit[perm[i]];
+        if (ok)
+            hit[perm[i]] = 1;
+    }
+    free(hit);
+    return ok;
+}
+
+// Renumber rows and columns of the local rows (owned under row_offsets) by
+// perm and move them to their owners under new_offsets.
+void permute_rows(coo_matrix *local, const int *row_offsets, const int *perm, const int *new_offsets, MPI_Comm comm)
+{
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    int rstart = row_offsets[rank], num_cols = local->num_cols;
+
+    coo_entry *entries = (coo_entry *)malloc(local->num_nonzeros * sizeof(coo_entry) + 1);
+    for (int k = 0; k < local->num_nonzeros; k++)
+    {
+        entries[k].row = perm[local->rows[k] + rstart];
+        entries[k].col = perm[local->cols[k]];
+        entries[k].val = local->vals[k];
+    }
+    int n = local->num_nonzeros;
+    delete_coo_matrix(local);
+    dist_exchange_entries(entries, n, new_offsets, num_cols, comm, local);
+}
+
+// Per-rank rows, nonzeros, remote (ghost) columns and SpMV compute time,
+// gathered on rank 0: one summary line with the max/avg imbalance, and a
+// line per rank when verbose.
+void print_load_report(const coo_matrix *local, int remote_cols, double compute_time, const char *partition,
+                       int verbose, MPI_Comm comm)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    double mine[4] = {local->num_rows, local->num_nonzeros, remote_cols, compute_time};
+    double *all = NULL;
+    if (rank == 0)
+        all = (double *)malloc(4 * size * sizeof(double));
+    MPI_Gather(mine, 4, MPI_DOUBLE, all, 4, MPI_DOUBLE, 0, comm);
+    if (rank != 0)
+        return;
+
+    double max[4] = {0}, sum[4] = {0};
+    for (int p = 0; p < size; p++)
+        for (int f = 0; f < 4; f++)
+        {
+            max[f] = all[4 * p + f] > max[f] ? all[4 * p + f] : max[f];
+            sum[f] += all[4 * p + f];
+        }
+
+    if (verbose)
+    {
+        printf("\n\t%6s %12s %12s %12s %12s\n", "rank", "rows", "nonzeros", "remote cols", "compute ms");
+        for (int p = 0; p < size; p++)
+            printf("\t%6d %12.0f %12.0f %12.0f %12.4f\n", p, all[4 * p], all[4 * p + 1], all[4 * p + 2],
+                   all[4 * p + 3] * 1e3);
+    }
+    printf("Load balance (%s partition): nonzeros max/avg %.3f, remote cols max/avg %.3f, compute max/avg %.3f\n",
+           partition, sum[1] > 0 ? max[1] * size / sum[1] : 1.0, sum[2] > 0 ? max[2] * size / sum[2] : 1.0,
+           sum[3] > 0 ? max[3] * size / sum[3] : 1.0);
+    free(all);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+// Wall-clock time of each phase of a distributed run, kept on every rank
+// and reduced on rank 0 to min, max, mean and imbalance (max / mean) per
+// phase, optionally with the per-rank table. A slow run then shows whether
+// it is compute imbalance, ranks waiting on the root during read and
+// distribution, or the network during the exchange. Include after mpi.h.
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef enum phase
+{
+    PHASE_READ,
+    PHASE_DISTRIBUTE,
+    PHASE_PARTITION,
+    PHASE_HALO_SETUP,
+    PHASE_EXCHANGE,
+    PHASE_COMPUTE,
+    PHASE_GATHER,
+    NUM_PHASES
+} phase;
+
+static const char *phase_names[NUM_PHASES] = {"read", "distribute", "partition", "halo setup",
+                                              "halo exchange", "compute", "gather"};
+
+typedef struct phase_timers
+{
+    double seconds[NUM_PHASES];  //negative for phases that did not run
+} phase_timers;
+
+void phase_timers_init(phase_timers *t)
+{
+    for (int p = 0; p < NUM_PHASES; p++)
+        t->seconds[p] = -1;
+}
+
+void phase_add(phase_timers *t, phase p, double seconds)
+{
+    t->seconds[p] = (t->seconds[p] < 0 ? 0 : t->seconds[p]) + seconds;
+}
+
+// Summary of every phase that ran, and with per_rank each rank's times,
+// printed on rank 0.
+void phase_report(const phase_timers *t, int per_rank, MPI_Comm comm)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    double *all = NULL;
+    if (rank == 0)
+        all = (double *)malloc(NUM_PHASES * size * sizeof(double));
+    MPI_Gather(t->seconds, NUM_PHASES, MPI_DOUBLE, all, NUM_PHASES, MPI_DOUBLE, 0, comm);
+    if (rank != 0)
+        return;
+
+    int ran[NUM_PHASES] = {0};
+    for (int r = 0; r < size; r++)
+        for (int p = 0; p < NUM_PHASES; p++)
+            ran[p] |= all[NUM_PHASES * r + p] >= 0;
+
+    if (per_rank)
+    {
+        printf("\n\t%6s", "rank");
+        for (int p = 0; p < NUM_PHASES; p++)
+            if (ran[p])
+                printf(" %13s", phase_names[p]);
+        printf("   (ms)\n");
+        for (int r = 0; r < size; r++)
+        {
+            printf("\t%6d", r);
+            for (int p = 0; p < NUM_PHASES; p++)
+                if (ran[p])
+                    printf(" %13.4f", 1e3 * (all[NUM_PHASES * r + p] > 0 ? all[NUM_PHASES * r + p] : 0));
+            printf("\n");
+        }
+    }
+
+    printf("Phase times over %d ranks (ms):\n", size);
+    printf("\t%-14s %12s %12s %12s %10s %8s\n", "phase", "min", "max", "mean", "max/mean", "slowest");
+    for (int p = 0; p < NUM_PHASES; p++)
+    {
+        if (!ran[p])
+            continue;
+        double min = 0, max = 0, sum = 0;
+        int slowest = 0;
+        for (int r = 0; r < size; r++)
+        {
+            double s = all[NUM_PHASES * r + p] > 0 ? all[NUM_PHASES * r + p] : 0;
+            if (r == 0 || s < min)
+                min = s;
+            if (r == 0 || s > max)
+            {
+                max = s;
+                slowest = r;
+            }
+            sum += s;
+        }
+        double mean = sum / size;
+        printf("\t%-14s %12.4f %12.4f %12.4f %10.3f %8d\n", phase_names[p], 1e3 * min, 1e3 * max, 1e3 * mean,
+               mean > 0 ? max / mean : 1.0, slowest);
+    }
+    free(all);
+}
@@ -7,6 +7,15 @@
 #include "config.h"
 #include "timer.h"
 #include "formats.h"
+#include "perf_counters.h"
+#include "energy.h"
+#include "dist_input.h"
+#include "partition.h"
+#include "halo.h"
+#include "dist_vector.h"
+#include "phase_timer.h"
+#include "checkerboard.h"
+#include "node_shared.h"
 
 #define max(a, b) \
     ({ __typeof__ (a) _a = (a); __typeof__ (b) _b = (b); \
@@ -16,230 +25,1149 @@
     ({ __typeof__ (a) _a = (a); __typeof__ (b) _b = (b); \
        _a < _b ? _a : _b; })
 
+// Default relative residual at which --cg stops.
+#define CG_TOLERANCE 1e-5
+// Pipelined CG iterations between residual replacements.
+#define CG_REPLACE_INTERVAL 20
+
 void usage(int argc, char **argv)
 {
     printf("Usage: %s [my_matrix.mtx]\n", argv[0]);
     printf("Note: my_matrix.mtx must be a real-valued sparse matrix in MatrixMarket format.\n");
+    printf("      Binary COO files written by ../spmv-omp/matgen are accepted as well.\n");
+    printf("Options:\n");
+    printf("  --root-read  Read the whole matrix on rank 0 and send each rank its rows (default: every rank\n");
+    printf("               reads a slice of the file with MPI-IO and nonzeros move to their owners in one Alltoallv)\n");
+    printf("  --partition=<kind>[,param]  How rows are split across ranks:\n");
+    printf("               rows (default) equal row counts; nnz equal nonzero counts;\n");
+    printf("               weighted[,cost] nonzeros plus cost (default %.1f) per distinct remote column;\n",
+           PARTITION_REMOTE_COST);
+    printf("               feedback[,rounds] nonzeros scaled by each rank's measured SpMV rate, re-cut rounds\n");
+    printf("               times (default %d)\n", PARTITION_FEEDBACK_ROUNDS);
+    printf("               hypergraph[,imbalance] multilevel partitioner minimising the halo volume with nonzeros\n");
+    printf("               balanced within imbalance (default %.2f); renumbers rows and columns (square matrices).\n",
+           PARTITION_IMBALANCE);
+    printf("               Not scalable: the whole pattern is gathered and partitioned on rank 0, and every\n");
+    printf("               rank holds the full row numbering\n");
+    printf("  --2d      Checkerboard layout on a sqrt(P) x sqrt(P) process grid (MPI_Dims_create for other P):\n");
+    printf("            x expanded along process columns, y folded along process rows, each step timed\n");
+    printf("            (--partition, --perf and --energy apply to the 1D row layout only)\n");
+    printf("  --node-shared[=ranks]  One x per node in an MPI-3 shared-memory window, read directly by all ranks\n");
+    printf("             and threads; only off-node ghosts are exchanged. =ranks groups that many ranks per\n");
+    printf("             window (default: all ranks sharing memory)\n");
+    printf("  --overlap  Split each rank's nonzeros into interior (owned x) and boundary (ghost x); post the halo\n");
+    printf("             with Isend/Irecv, multiply the interior while it is in flight, then the boundary, and\n");
+    printf("             report how much of the blocking exchange time was hidden\n");
+    printf("  --phases  Print every rank's phase times (read, distribute, partition, halo setup, halo exchange,\n");
+    printf("            compute, gather) above the min/max/mean/imbalance summary printed after the SpMV\n");
+    printf("  --load-report  Print rows, nonzeros, remote columns and compute time of every rank\n");
+    printf("  --perf    Print hardware counters for the SpMV compute region, summed over all ranks\n");
+    printf("  --energy  Print RAPL package/DRAM energy of the timed SpMV (halo exchange and compute), summed over nodes\n");
+    printf("  --gather  Collect y on rank 0 after the timed SpMV, timed separately (rows in partition order)\n");
+    printf("  --iterations=N  Then run N power-iteration steps y = A x, x = y / ||y|| on the distributed vectors\n");
+    printf("               (square matrices); nothing goes through rank 0\n");
+    printf("  --cg=N[,tol]  Solve A x = b (b = A x for the x above) with classical CG and with pipelined CG\n");
+    printf("               (Ghysels-Vanroose: one MPI_Iallreduce per iteration, overlapped with the SpMV), at\n");
+    printf("               most N iterations or until ||r|| / ||b|| < tol (default %g; 0 runs all N), and\n",
+           CG_TOLERANCE);
+    printf("               compare them (symmetric positive definite matrices)\n");
+    printf("  --persistent  Exchange ghosts of the distributed vectors (SpMV, --iterations, --cg) through\n");
+    printf("               persistent requests created once per vector\n");
+    printf("  --halo-bench=N  Time N halo exchanges, alone and each with the local SpMV, through\n");
+    printf("               MPI_Neighbor_alltoallv, per-exchange Isend/Irecv and persistent requests\n");
 }
 
-void verify_integer_portion(float *sequential_y, float *parallel_y, int num_rows)
+// x[j] in [-1, 1) as a function of j alone, so every rank fills its own
+// slice of x without generating or broadcasting the whole vector.
+float x_value(int j)
 {
-    int correct = 1;
-    for (int i = 0; i < num_rows; i++)
+    unsigned long long z = (unsigned long long)j * 0x9E3779B97F4A7C15ULL + 13;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return 1.0f - 2.0f * (float)((z >> 40) / 16777216.0);
+}
+
+// Fill the owned part of a halo-layout x.
+void init_x(const halo_plan *plan, float *x)
+{
+    for (int i = 0; i < plan->num_owned; i++)
+        x[i] = x_value(plan->cstart + i);
+}
+
+// x is distributed like y when the matrix is square, so y can be the next
+// x; otherwise in equal column blocks.
+void column_offsets(int num_rows, int num_cols, const int *row_offsets, int size, int *col_offsets)
+{
+    if (num_rows == num_cols)
+        memcpy(col_offsets, row_offsets, (size + 1) * sizeof(int));
+    else
+        block_row_offsets(num_cols, size, col_offsets);
+}
+
+// Local SpMV on this rank's rows: y += A x, with row indices local and
+// column indices into the halo-layout x (owned entries, then ghosts).
+void local_spmv(const coo_matrix *A, const float *x, float *y)
+{
+#pragma omp parallel for
+    for (int i = 0; i < A->num_nonzeros; i++)
     {
-        int seq_int = (int)(sequential_y[i] + 0.5);
-        int par_int = (int)(parallel_y[i] + 0.5);
-        if (seq_int != par_int)
+#pragma omp atomic
+        y[A->rows[i]] += A->vals[i] * x[A->cols[i]];
+    }
+}
+
+// Interior nonzeros multiplied between polls of the in-flight halo.
+#define OVERLAP_CHUNK 32768
+
+// Local SpMV on the interior in chunks, polling the halo between them so the
+// exchange progresses while we compute.
+void interior_spmv(const coo_matrix *A, const float *x, float *y, halo_plan *plan)
+{
+    for (int k = 0; k < A->num_nonzeros; k += OVERLAP_CHUNK)
+    {
+        coo_matrix chunk = *A;
+        chunk.rows += k;
+        chunk.cols += k;
+        chunk.vals += k;
+        chunk.num_nonzeros = A->num_nonzeros - k < OVERLAP_CHUNK ? A->num_nonzeros - k : OVERLAP_CHUNK;
+        local_spmv(&chunk, x, y);
+        halo_progress(plan);
+    }
+}
+
+// y = A x on distributed vectors: refresh x's ghosts, then the local SpMV.
+void dist_spmv(const coo_matrix *A, dist_vector *x, dist_vector *y)
+{
+    dist_vector_update_ghosts(x);
+    memset(y->data, 0, y->count * sizeof(float));
+    local_spmv(A, x->data, y->data);
+}
+
+// Power iteration on the distributed vectors: y = A x, then x = y / ||y||.
+// Each step is a halo exchange, the local SpMV and two Allreduces (the
+// Rayleigh quotient x.y and ||y||); no vector goes near rank 0. y's rows
+// must be x's owned entries, i.e. a square matrix.
+void power_iteration(const coo_matrix *A, dist_vector *x, dist_vector *y, int iterations, long long nonzeros)
+{
+    int rank;
+    MPI_Comm_rank(x->comm, &rank);
+
+    double norm = dist_norm(x), lambda = 0;
+    if (norm > 0)
+        dist_scale((float)(1 / norm), x);
+    MPI_Barrier(x->comm);
+    double t_start = MPI_Wtime();
+    int it;
+    for (it = 0; it < iterations; it++)
+    {
+        dist_spmv(A, x, y);
+        lambda = dist_dot(x, y);
+        norm = dist_norm(y);
+        if (norm == 0)
         {
-            printf("Mismatch at index %d: sequential integer portion = %d, parallel integer portion = %d\n", i, seq_int, par_int);
-            correct = 0;
+            it++;
+            break;
         }
+        dist_copy(y, x);
+        dist_scale((float)(1 / norm), x);
     }
-    if (correct)
-        printf("Verification successful: All integer portions match!\n");
-    else
-        printf("Verification failed: Some integer portions do not match!\n");
+    MPI_Barrier(x->comm);
+    double elapsed = MPI_Wtime() - t_start;
+    if (rank == 0)
+        printf("Power iteration: %d SpMVs took %f seconds (%f ms each, %f GFLOP/s), Rayleigh quotient %g\n", it,
+               elapsed, 1e3 * elapsed / it, 2.0 * nonzeros * it / elapsed / 1e9, lambda);
 }
 
-int main(int argc, char **argv)
+// Classical CG for A x = b from x = 0. Every iteration is one SpMV and two
+// blocking Allreduces (p.q for alpha, then r.r for beta), each of which
+// waits for every rank. Returns the iterations done; the time spent in the
+// reductions' MPI calls is added to reduce_time.
+int cg_classical(const coo_matrix *A, const dist_vector *b, dist_vector *x, int max_iterations, double tolerance,
+                 double *reduce_time)
+{
+    dist_vector r, p, q;
+    dist_vector_create(&r, x->plan, x->comm);
+    dist_vector_create(&p, x->plan, x->comm);
+    dist_vector_create(&q, x->plan, x->comm);
+    memset(x->data, 0, x->count * sizeof(float));
+    dist_copy(b, &r);
+    dist_copy(b, &p);
+
+    double local = dist_local_dot(&r, &r), rr, pq, rr_next;
+    double t_reduce = MPI_Wtime();
+    MPI_Allreduce(&local, &rr, 1, MPI_DOUBLE, MPI_SUM, x->comm);
+    *reduce_time += MPI_Wtime() - t_reduce;
+    double bb = rr;
+    int it;
+    for (it = 0; it < max_iterations && sqrt(rr) > tolerance * sqrt(bb); it++)
+    {
+        dist_spmv(A, &p, &q);
+        local = dist_local_dot(&p, &q);
+        t_reduce = MPI_Wtime();
+        MPI_Allreduce(&local, &pq, 1, MPI_DOUBLE, MPI_SUM, x->comm);
+        *reduce_time += MPI_Wtime() - t_reduce;
+        double alpha = rr / pq;
+        dist_axpy((float)alpha, &p, x);
+        dist_axpy((float)-alpha, &q, &r);
+        local = dist_local_dot(&r, &r);
+        t_reduce = MPI_Wtime();
+        MPI_Allreduce(&local, &rr_next, 1, MPI_DOUBLE, MPI_SUM, x->comm);
+        *reduce_time += MPI_Wtime() - t_reduce;
+        dist_scale((float)(rr_next / rr), &p);
+        dist_axpy(1, &r, &p);
+        rr = rr_next;
+    }
+
+    dist_vector_free(&r);
+    dist_vector_free(&p);
+    dist_vector_free(&q);
+    return it;
+}
+
+// Pipelined CG (Ghysels and Vanroose, 2014) for A x = b from x = 0. The
+// recurrences carry w = A r, s = A p and z = A s alongside r and p, so both
+// dots of an iteration (r.r and w.r) go in one MPI_Iallreduce that is in
+// flight during that iteration's SpMV m = A w. The price is three extra
+// vector updates per iteration and recurrences that drift from the true
+// residual, badly so in single precision; every CG_REPLACE_INTERVAL
+// iterations r, w, s and z are recomputed from x and p (four SpMVs).
+int cg_pipelined(const coo_matrix *A, const dist_vector *b, dist_vector *x, int max_iterations, double tolerance,
+                 double *reduce_time)
+{
+    dist_vector r, w, m, z, s, p;
+    dist_vector_create(&r, x->plan, x->comm);
+    dist_vector_create(&w, x->plan, x->comm);
+    dist_vector_create(&m, x->plan, x->comm);
+    dist_vector_create(&z, x->plan, x->comm);
+    dist_vector_create(&s, x->plan, x->comm);
+    dist_vector_create(&p, x->plan, x->comm);
+    memset(x->data, 0, x->count * sizeof(float));
+    dist_copy(b, &r);
+    dist_spmv(A, &r, &w);
+
+    double gamma_prev = 0, alpha_prev = 0, bb = 0;
+    int it;
+    for (it = 0; it < max_iterations; it++)
+    {
+        if (it > 0 && it % CG_REPLACE_INTERVAL == 0)
+        {
+            dist_spmv(A, x, &r);
+            dist_scale(-1, &r);
+            dist_axpy(1, b, &r);
+            dist_spmv(A, &r, &w);
+            dist_spmv(A, &p, &s);
+            dist_spmv(A, &s, &z);
+        }
+        double local[2] = {dist_local_dot(&r, &r), dist_local_dot(&w, &r)}, global[2];
+        double t_reduce = MPI_Wtime();
+        MPI_Request request;
+        MPI_Iallreduce(local, global, 2, MPI_DOUBLE, MPI_SUM, x->comm, &request);
+        *reduce_time += MPI_Wtime() - t_reduce;
+        dist_spmv(A, &w, &m);
+        t_reduce = MPI_Wtime();
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+        *reduce_time += MPI_Wtime() - t_reduce;
+
+        double gamma = global[0], delta = global[1];
+        if (it == 0)
+            bb = gamma;
+        if (sqrt(gamma) <= tolerance * sqrt(bb))
+            break;
+        double beta = it > 0 ? gamma / gamma_prev : 0;
+        double alpha = it > 0 ? gamma / (delta - beta * gamma / alpha_prev) : gamma / delta;
+        dist_scale((float)beta, &z);
+        dist_axpy(1, &m, &z);
+        dist_scale((float)beta, &s);
+        dist_axpy(1, &w, &s);
+        dist_scale((float)beta, &p);
+        dist_axpy(1, &r, &p);
+        dist_axpy((float)alpha, &p, x);
+        dist_axpy((float)-alpha, &s, &r);
+        dist_axpy((float)-alpha, &z, &w);
+        gamma_prev = gamma;
+        alpha_prev = alpha;
+    }
+
+    dist_vector_free(&r);
+    dist_vector_free(&w);
+    dist_vector_free(&m);
+    dist_vector_free(&z);
+    dist_vector_free(&s);
+    dist_vector_free(&p);
+    return it;
+}
+
+// --halo-bench: the same exchange repeated through the blocking neighbour
+// collective, freshly posted Isend/Irecv, and persistent requests, alone and
+// followed by the local SpMV each time. Per-iteration times of the slowest
+// rank show what each path pays to set up every exchange.
+void halo_benchmark(const coo_matrix *A, halo_plan *plan, int iterations)
+{
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    float *x = (float *)calloc(plan->num_owned + plan->num_ghosts + 1, sizeof(float));
+    float *y = (float *)calloc(A->num_rows + 1, sizeof(float));
+    init_x(plan, x);
+    halo_persistent persistent;
+    halo_persistent_init(plan, x, &persistent);
+
+    const char *names[3] = {"Neighbor_alltoallv", "Isend/Irecv", "persistent"};
+    double times[3][2], max_times[3][2];
+    for (int path = 0; path < 3; path++)
+        for (int with_spmv = 0; with_spmv < 2; with_spmv++)
+        {
+            // One untimed round so connections are set up for every path.
+            for (int it = -1; it < iterations; it++)
+            {
+                if (it == 0)
+                {
+                    MPI_Barrier(MPI_COMM_WORLD);
+                    times[path][with_spmv] = MPI_Wtime();
+                }
+                if (path == 0)
+                    halo_exchange(plan, x);
+                else if (path == 1)
+                {
+                    halo_begin(plan, x);
+                    halo_end(plan);
+                }
+                else
+                    halo_persistent_exchange(&persistent);
+                if (with_spmv)
+                    local_spmv(A, x, y);
+            }
+            times[path][with_spmv] = (MPI_Wtime() - times[path][with_spmv]) / iterations;
+        }
+    MPI_Reduce(times, max_times, 6, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+    {
+        printf("Halo benchmark, %d iterations (us per iteration, slowest rank):\n", iterations);
+        printf("\t%-20s %12s %16s\n", "path", "exchange", "exchange+SpMV");
+        for (int path = 0; path < 3; path++)
+            printf("\t%-20s %12.3f %16.3f\n", names[path], 1e6 * max_times[path][0], 1e6 * max_times[path][1]);
+    }
+
+    halo_persistent_free(&persistent);
+    free(x);
+    free(y);
+}
+
+// --cg: solve A x = b for b = A x_star, x_star the x of the single SpMV,
+// with both CG variants, and print per solver the time per iteration, the
+// time spent in reductions (slowest rank), and the true relative residual
+// and error of the result.
+void cg_compare(const coo_matrix *A, halo_plan *plan, int max_iterations, double tolerance)
 {
     int rank, size;
-    MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    coo_matrix global_coo;
-    int global_num_rows, global_num_cols;
-    float *x = NULL;
+    dist_vector x_star, x, b, check;
+    dist_vector_create(&x_star, plan, MPI_COMM_WORLD);
+    dist_vector_create(&x, plan, MPI_COMM_WORLD);
+    dist_vector_create_range(&b, plan->cstart, plan->num_owned, MPI_COMM_WORLD);
+    dist_vector_create_range(&check, plan->cstart, plan->num_owned, MPI_COMM_WORLD);
+    init_x(plan, x_star.data);
+    dist_spmv(A, &x_star, &b);
+    double b_norm = dist_norm(&b), x_star_norm = dist_norm(&x_star);
 
-    if (rank == 0)
+    const char *names[2] = {"classical", "pipelined"};
+    for (int solver = 0; solver < 2; solver++)
+    {
+        double reduce_time = 0;
+        MPI_Barrier(MPI_COMM_WORLD);
+        double t_start = MPI_Wtime();
+        int iterations = solver == 0 ? cg_classical(A, &b, &x, max_iterations, tolerance, &reduce_time)
+                                     : cg_pipelined(A, &b, &x, max_iterations, tolerance, &reduce_time);
+        MPI_Barrier(MPI_COMM_WORLD);
+        double elapsed = MPI_Wtime() - t_start;
+
+        dist_spmv(A, &x, &check);
+        dist_axpy(-1, &b, &check);
+        double residual = dist_norm(&check) / b_norm;
+        dist_copy(&x, &check);
+        dist_axpy(-1, &x_star, &check);
+        double error = dist_norm(&check) / x_star_norm;
+        double max_reduce_time;
+        MPI_Reduce(&reduce_time, &max_reduce_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        if (rank == 0)
+            printf("CG (%s, %d ranks): %d iterations took %f seconds (%f ms each, reductions %f ms each); "
+                   "residual %.3e, error %.3e\n",
+                   names[solver], size, iterations, elapsed, 1e3 * elapsed / (iterations > 0 ? iterations : 1),
+                   1e3 * max_reduce_time / (iterations > 0 ? iterations : 1), residual, error);
+    }
+
+    dist_vector_free(&x_star);
+    dist_vector_free(&x);
+    dist_vector_free(&b);
+    dist_vector_free(&check);
+}
+
+// Local SpMV runs per feedback measurement; the fastest one is used.
+#define FEEDBACK_SPMV_RUNS 10
+
+// Re-cut the rows by the chosen strategy and move the nonzeros to their new
+// owners. row_offsets holds the current cuts on entry and the new ones on
+// return. The feedback split starts from equal nonzeros, then repeatedly
+// times every rank's local SpMV and weights its rows by its measured time
+// per nonzero, so slower ranks get fewer rows. The hypergraph split also
+// renumbers rows and columns and hands back that numbering in *perm (NULL
+// otherwise); it returns the halo volume it predicts, the others -1.
+long long balance_rows(const partition_options *part, coo_matrix *local, int *row_offsets, int num_rows, int **perm)
+{
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    int *new_offsets = (int *)malloc((size + 1) * sizeof(int));
+    int rounds = part->kind == PARTITION_FEEDBACK ? part->rounds : 0;
+    *perm = NULL;
+
+    if (part->kind == PARTITION_HYPERGRAPH && local->num_cols == num_rows)
     {
-        if (argc < 2)
+        *perm = (int *)malloc(num_rows * sizeof(int) + 1);
+        long long block_volume;
+        long long predicted = hypergraph_row_permutation(local, row_offsets, num_rows, part->imbalance,
+                                                         MPI_COMM_WORLD, *perm, new_offsets, &block_volume);
+        if (!is_permutation(*perm, num_rows))
         {
-            printf("Give a MatrixMarket file.\n");
-            MPI_Abort(MPI_COMM_WORLD, -1);
+            if (rank == 0)
+                printf("Verification failed: hypergraph row numbering is not a permutation\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
         }
-        char *mm_filename = argv[1];
-        printf("Reading matrix from file %s\n", mm_filename);
-        read_coo_matrix(&global_coo, mm_filename);
-        global_num_rows = global_coo.num_rows;
-        global_num_cols = global_coo.num_cols;
+        if (rank == 0)
+            printf("\thypergraph partition predicts %lld x entries moved per SpMV (contiguous blocks: %lld)\n",
+                   predicted, block_volume);
+        permute_rows(local, row_offsets, *perm, new_offsets, MPI_COMM_WORLD);
+        memcpy(row_offsets, new_offsets, (size + 1) * sizeof(int));
+        free(new_offsets);
+        return predicted;
+    }
+    if (part->kind == PARTITION_HYPERGRAPH && rank == 0)
+        printf("\thypergraph partitioning needs a square matrix; splitting by nonzeros instead\n");
 
-        x = (float *)malloc(global_num_cols * sizeof(float));
-        srand(13);
-        for (int i = 0; i < global_num_cols; i++)
+    for (int round = 0; round <= rounds; round++)
+    {
+        int rstart = row_offsets[rank], rcount = row_offsets[rank + 1] - rstart;
+        double *weight = (double *)malloc(rcount * sizeof(double) + 1);
+        row_nnz_weights(local, weight);
+        if (part->kind == PARTITION_WEIGHTED)
+            count_remote_columns(local, rstart, weight, part->remote_cost);
+
+        if (round > 0)
         {
-            x[i] = 1.0 - 2.0 * (rand() / (RAND_MAX + 1.0));
+            int *col_offsets = (int *)malloc((size + 1) * sizeof(int));
+            column_offsets(num_rows, local->num_cols, row_offsets, size, col_offsets);
+            halo_plan plan;
+            coo_matrix relabelled = *local;
+            relabelled.cols = (int *)malloc(local->num_nonzeros * sizeof(int) + 1);
+            halo_setup(local, col_offsets, MPI_COMM_WORLD, &plan, relabelled.cols);
+            float *x = (float *)malloc((plan.num_owned + plan.num_ghosts) * sizeof(float) + 1);
+            init_x(&plan, x);
+            halo_exchange(&plan, x);
+
+            float *y = (float *)calloc(rcount + 1, sizeof(float));
+            double best = 0;
+            for (int r = 0; r < FEEDBACK_SPMV_RUNS; r++)
+            {
+                double t = MPI_Wtime();
+                local_spmv(&relabelled, x, y);
+                t = MPI_Wtime() - t;
+                best = (r == 0 || t < best) ? t : best;
+            }
+            free(y);
+            free(x);
+            free(relabelled.cols);
+            free(col_offsets);
+            halo_free(&plan);
+
+            double seconds_per_nnz = best / (local->num_nonzeros > 0 ? local->num_nonzeros : 1);
+            for (int i = 0; i < rcount; i++)
+                weight[i] *= seconds_per_nnz;
+
+            double max_time, sum_time;
+            MPI_Reduce(&best, &max_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+            MPI_Reduce(&best, &sum_time, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+            if (rank == 0)
+                printf("\tfeedback round %d: compute max/avg %.3f before re-cut\n", round,
+                       sum_time > 0 ? max_time * size / sum_time : 1.0);
         }
-        printf("\nfile=%s rows=%d cols=%d nonzeros=%d\n", mm_filename, global_num_rows, global_num_cols, global_coo.num_nonzeros);
-        fflush(stdout);
+
+        weighted_row_offsets(weight, rstart, rcount, num_rows, MPI_COMM_WORLD, new_offsets);
+        free(weight);
+        repartition_rows(local, row_offsets, new_offsets, MPI_COMM_WORLD);
+        memcpy(row_offsets, new_offsets, (size + 1) * sizeof(int));
     }
+    free(new_offsets);
+    return -1;
+}
 
-    MPI_Bcast(&global_num_rows, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(&global_num_cols, 1, MPI_INT, 0, MPI_COMM_WORLD);
+// Reference y = A x for verification, from the nonzeros exactly as they were
+// read (global indices), so it does not go through the exchange, the
+// re-cuts or the permutation it checks. Every rank multiplies its entries,
+// renumbered by perm when the rows were permuted (NULL otherwise), sends
+// each product to the owner of its row under the final row_offsets and sums
+// what it receives. Returns this rank's rows; frees entries.
+float *reference_y(coo_entry *entries, int n, const int *perm, const int *row_offsets, MPI_Comm comm)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int rstart = row_offsets[rank], rcount = row_offsets[rank + 1] - rstart;
 
-    if (rank != 0)
+    int *dest = (int *)malloc(n * sizeof(int) + 1);
+    for (int k = 0; k < n; k++)
     {
-        x = (float *)malloc(global_num_cols * sizeof(float));
+        int i = perm ? perm[entries[k].row] : entries[k].row;
+        int j = perm ? perm[entries[k].col] : entries[k].col;
+        entries[k].row = i;
+        entries[k].val *= x_value(j);
+        dest[k] = row_owner(row_offsets, size, i);
     }
-    MPI_Bcast(x, global_num_cols, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    int num_recv;
+    coo_entry *products = dist_send_entries(entries, n, dest, comm, &num_recv);
 
-    int rows_per_proc = global_num_rows / size;
-    int extra = global_num_rows % size;
-    int rstart = rank * rows_per_proc + (rank < extra ? rank : extra);
-    int rcount = rows_per_proc + (rank < extra ? 1 : 0);
-    int rend = rstart + rcount;
+    float *y = (float *)calloc(rcount + 1, sizeof(float));
+    for (int k = 0; k < num_recv; k++)
+        y[products[k].row - rstart] += products[k].val;
+    free(products);
+    free(dest);
+    return y;
+}
+
+// Every rank checks its own rows (global indices from rstart); rank 0
+// reports the verdict.
+void verify_integer_portion(const float *sequential_y, const float *parallel_y, int num_rows, int rstart)
+{
+    int mismatches = 0, total;
+    for (int i = 0; i < num_rows; i++)
+    {
+        int seq_int = (int)(sequential_y[i] + 0.5);
+        int par_int = (int)(parallel_y[i] + 0.5);
+        if (seq_int != par_int)
+        {
+            printf("Mismatch at index %d: sequential integer portion = %d, parallel integer portion = %d\n", rstart + i, seq_int, par_int);
+            mismatches++;
+        }
+    }
+    MPI_Reduce(&mismatches, &total, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (rank != 0)
+        return;
+    if (total == 0)
+        printf("Verification successful: All integer portions match!\n");
+    else
+        printf("Verification failed: Some integer portions do not match!\n");
+}
 
-    int local_nonzeros;
-    int *local_rows = NULL;
-    int *local_cols = NULL;
-    float *local_vals = NULL;
+// Rank 0 splits the whole matrix by row owner and sends every rank its rows
+// (row indices made local). All OpenMP threads find and count the owners of
+// their static chunk of nonzeros in one pass; the per-thread counts give
+// each thread a fixed place in every rank's buffer, so a second pass packs
+// all ranks' rows at once and keeps the file order within each rank. Under
+// MPI_THREAD_MULTIPLE the threads then post different ranks' MPI_Isends
+// concurrently; otherwise the master thread posts them.
+void root_scatter_matrix(const int *row_offsets, coo_matrix *global, coo_matrix *local)
+{
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    int rstart = row_offsets[rank], rcount = row_offsets[rank + 1] - rstart;
 
+    local->num_rows = rcount;
     if (rank == 0)
     {
-        local_nonzeros = 0;
-        for (int i = 0; i < global_coo.num_nonzeros; i++)
+        int nnz = global->num_nonzeros;
+        int nthreads = omp_get_max_threads();
+        int *owner = (int *)malloc(nnz * sizeof(int) + 1);
+        int *counts = (int *)calloc((size_t)nthreads * size, sizeof(int));  //counts[t * size + p]
+#pragma omp parallel num_threads(nthreads)
         {
-            int r = global_coo.rows[i];
-            if (r >= rstart && r < rend)
-                local_nonzeros++;
+            int *mine = counts + (size_t)omp_get_thread_num() * size;
+#pragma omp for schedule(static)
+            for (int i = 0; i < nnz; i++)
+            {
+                owner[i] = row_owner(row_offsets, size, global->rows[i]);
+                mine[owner[i]]++;
+            }
         }
-        local_rows = (int *)malloc(local_nonzeros * sizeof(int));
-        local_cols = (int *)malloc(local_nonzeros * sizeof(int));
-        local_vals = (float *)malloc(local_nonzeros * sizeof(float));
-        int idx = 0;
-        for (int i = 0; i < global_coo.num_nonzeros; i++)
+
+        // Rank p's rows go to [displs[p], displs[p + 1]), thread t's share
+        // of them from next[t * size + p] on.
+        int *displs = (int *)malloc((size + 1) * sizeof(int));
+        int *next = (int *)malloc((size_t)nthreads * size * sizeof(int));
+        int total = 0;
+        for (int p = 0; p < size; p++)
         {
-            int r = global_coo.rows[i];
-            if (r >= rstart && r < rend)
+            displs[p] = total;
+            for (int t = 0; t < nthreads; t++)
             {
-                local_rows[idx] = r - rstart;
-                local_cols[idx] = global_coo.cols[i];
-                local_vals[idx] = global_coo.vals[i];
-                idx++;
+                next[t * size + p] = total;
+                total += counts[t * size + p];
             }
         }
-        // For every other process, filter its part
-        for (int p = 1; p < size; p++)
+        displs[size] = total;
+        int *rows = (int *)malloc(nnz * sizeof(int) + 1);
+        int *cols = (int *)malloc(nnz * sizeof(int) + 1);
+        float *vals = (float *)malloc(nnz * sizeof(float) + 1);
+#pragma omp parallel num_threads(nthreads)
         {
-            int prstart = p * rows_per_proc + (p < extra ? p : extra);
-            int prcount = rows_per_proc + (p < extra ? 1 : 0);
-            int prend = prstart + prcount;
-            int count = 0;
-            // Count nonzeros
-            for (int i = 0; i < global_coo.num_nonzeros; i++)
+            int *mine = next + (size_t)omp_get_thread_num() * size;
+#pragma omp for schedule(static)
+            for (int i = 0; i < nnz; i++)
             {
-                int r = global_coo.rows[i];
-                if (r >= prstart && r < prend)
-                    count++;
+                int k = mine[owner[i]]++;
+                rows[k] = global->rows[i] - row_offsets[owner[i]];
+                cols[k] = global->cols[i];
+                vals[k] = global->vals[i];
             }
-            MPI_Send(&count, 1, MPI_INT, p, 0, MPI_COMM_WORLD);
-            if (count > 0)
+        }
+
+        int provided;
+        MPI_Query_thread(&provided);
+        int *send_counts = (int *)malloc(size * sizeof(int));
+        MPI_Request *requests = (MPI_Request *)malloc(4 * size * sizeof(MPI_Request));
+#pragma omp parallel for schedule(dynamic) if (provided == MPI_THREAD_MULTIPLE)
+        for (int p = 1; p < size; p++)
+        {
+            MPI_Request *r = requests + 4 * p;
+            send_counts[p] = displs[p + 1] - displs[p];
+            MPI_Isend(&send_counts[p], 1, MPI_INT, p, 0, MPI_COMM_WORLD, &r[0]);
+            r[1] = r[2] = r[3] = MPI_REQUEST_NULL;
+            if (send_counts[p] > 0)
             {
-                int *tmp_rows = (int *)malloc(count * sizeof(int));
-                int *tmp_cols = (int *)malloc(count * sizeof(int));
-                float *tmp_vals = (float *)malloc(count * sizeof(float));
-                int idx2 = 0;
-                for (int i = 0; i < global_coo.num_nonzeros; i++)
-                {
-                    int r = global_coo.rows[i];
-                    if (r >= prstart && r < prend)
-                    {
-                        tmp_rows[idx2] = r - prstart;
-                        tmp_cols[idx2] = global_coo.cols[i];
-                        tmp_vals[idx2] = global_coo.vals[i];
-                        idx2++;
-                    }
-                }
-                MPI_Send(tmp_rows, count, MPI_INT, p, 1, MPI_COMM_WORLD);
-                MPI_Send(tmp_cols, count, MPI_INT, p, 2, MPI_COMM_WORLD);
-                MPI_Send(tmp_vals, count, MPI_FLOAT, p, 3, MPI_COMM_WORLD);
-                free(tmp_rows);
-                free(tmp_cols);
-                free(tmp_vals);
+                MPI_Isend(rows + displs[p], send_counts[p], MPI_INT, p, 1, MPI_COMM_WORLD, &r[1]);
+                MPI_Isend(cols + displs[p], send_counts[p], MPI_INT, p, 2, MPI_COMM_WORLD, &r[2]);
+                MPI_Isend(vals + displs[p], send_counts[p], MPI_FLOAT, p, 3, MPI_COMM_WORLD, &r[3]);
             }
         }
+        MPI_Waitall(4 * (size - 1), requests + 4, MPI_STATUSES_IGNORE);
+
+        local->num_nonzeros = displs[1];
+        local->rows = (int *)malloc(displs[1] * sizeof(int) + 1);
+        local->cols = (int *)malloc(displs[1] * sizeof(int) + 1);
+        local->vals = (float *)malloc(displs[1] * sizeof(float) + 1);
+        memcpy(local->rows, rows, displs[1] * sizeof(int));
+        memcpy(local->cols, cols, displs[1] * sizeof(int));
+        memcpy(local->vals, vals, displs[1] * sizeof(float));
+
+        free(owner);
+        free(counts);
+        free(displs);
+        free(next);
+        free(rows);
+        free(cols);
+        free(vals);
+        free(send_counts);
+        free(requests);
     }
     else
     {
-        // Other ranks receive the number of nonzeros and then
-        MPI_Recv(&local_nonzeros, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        if (local_nonzeros > 0)
+        // Other ranks receive the number of nonzeros and then the data.
+        MPI_Recv(&local->num_nonzeros, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        local->rows = (int *)malloc(local->num_nonzeros * sizeof(int) + 1);
+        local->cols = (int *)malloc(local->num_nonzeros * sizeof(int) + 1);
+        local->vals = (float *)malloc(local->num_nonzeros * sizeof(float) + 1);
+        if (local->num_nonzeros > 0)
         {
-            local_rows = (int *)malloc(local_nonzeros * sizeof(int));
-            local_cols = (int *)malloc(local_nonzeros * sizeof(int));
-            local_vals = (float *)malloc(local_nonzeros * sizeof(float));
-            MPI_Recv(local_rows, local_nonzeros, MPI_INT, 0, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            MPI_Recv(local_cols, local_nonzeros, MPI_INT, 0, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            MPI_Recv(local_vals, local_nonzeros, MPI_FLOAT, 0, 3, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            MPI_Recv(local->rows, local->num_nonzeros, MPI_INT, 0, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            MPI_Recv(local->cols, local->num_nonzeros, MPI_INT, 0, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            MPI_Recv(local->vals, local->num_nonzeros, MPI_FLOAT, 0, 3, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
         }
     }
+}
 
-    float *local_y = (float *)calloc(rcount, sizeof(float));
+// --node-shared: one SpMV reading x from the node's shared window. local
+// holds this rank's rows with global column indices; they are relabelled to
+// offsets into the window.
+void node_shared_spmv(coo_matrix *local, const int *col_offsets, int rstart, int rcount, long long num_nonzeros,
+                      float *sequential_y, int ranks_per_node, const char *name, int load_report)
+{
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    node_x nx;
+    int *node_cols = (int *)malloc(local->num_nonzeros * sizeof(int) + 1);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t_setup = MPI_Wtime();
+    node_x_setup(local, col_offsets, ranks_per_node, MPI_COMM_WORLD, &nx, node_cols);
+    double setup_time = MPI_Wtime() - t_setup;
+    node_x_report(&nx, local, col_offsets, MPI_COMM_WORLD);
+    free(local->cols);
+    local->cols = node_cols;
+    if (rank == 0)
+        printf("Node window setup took %f seconds\n", setup_time);
+
+    // Each rank writes its owned slice straight into the window.
+    for (int i = 0; i < nx.plan.num_owned; i++)
+        nx.segment[i] = x_value(nx.plan.cstart + i);
+    float *y = (float *)calloc(rcount + 1, sizeof(float));
 
     MPI_Barrier(MPI_COMM_WORLD);
     double t_start = MPI_Wtime();
+    node_x_update(&nx);
+    double update_time = MPI_Wtime() - t_start;
+    double t_compute = MPI_Wtime();
+    local_spmv(local, nx.base, y);
+    double compute_time = MPI_Wtime() - t_compute;
+    MPI_Barrier(MPI_COMM_WORLD);
+    double elapsed = MPI_Wtime() - t_start;
+
+    double max_update_time;
+    MPI_Reduce(&update_time, &max_update_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    print_load_report(local, nx.plan.num_ghosts, compute_time, name, load_report, MPI_COMM_WORLD);
 
-#pragma omp parallel for default(none) shared(local_nonzeros, local_y, local_rows, local_vals, x, local_cols)
-    for (int i = 0; i < local_nonzeros; i++)
+    if (rank == 0)
+        printf("\nVerifying results based on integer portions\n");
+    verify_integer_portion(sequential_y, y, rcount, rstart);
+    if (rank == 0)
     {
-#pragma omp atomic
-        local_y[local_rows[i]] += local_vals[i] * x[local_cols[i]];
+        printf("Single spMV run took %f seconds, achieving %f GFLOP/s\n", elapsed, 2.0 * num_nonzeros / elapsed / 1e9);
+        printf("\toff-node ghost fetch and node barrier took %f seconds (slowest rank)\n", max_update_time);
     }
 
-    float *global_y = NULL;
-    int *recvcounts = NULL;
-    int *displs = NULL;
+    free(y);
+    node_x_free(&nx);
+}
+
+// --2d: one SpMV on the checkerboard layout, with the expand, multiply and
+// fold timed separately. local holds this rank's rows of the 1D layout and
+// is consumed; the result is moved back to that layout and checked against
+// sequential_y, this rank's rows of the reference product.
+void checkerboard_spmv(coo_matrix *local, const int *row_offsets, int num_rows, int num_cols,
+                       long long num_nonzeros, const float *sequential_y, int load_report)
+{
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    int rstart = row_offsets[rank], rcount = row_offsets[rank + 1] - rstart;
+
+    checkerboard cb;
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t_setup = MPI_Wtime();
+    checkerboard_setup(local, row_offsets, num_rows, num_cols, MPI_COMM_WORLD, &cb);
+    double setup_time = MPI_Wtime() - t_setup;
+    if (rank == 0)
+        printf("2D grid %d x %d, blocks of about %d x %d; setup took %f seconds\n", cb.pr, cb.pc, cb.rcount, cb.ccount,
+               setup_time);
+
+    float *x_piece = (float *)malloc(cb.x_count * sizeof(float) + 1);
+    float *y_piece = (float *)malloc(cb.y_count * sizeof(float) + 1);
+    for (int i = 0; i < cb.x_count; i++)
+        x_piece[i] = x_value(cb.x_start + i);
+
+    double step_times[3], max_step_times[3];
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t_start = MPI_Wtime();
+    checkerboard_expand(&cb, x_piece);
+    double t_step = MPI_Wtime();
+    step_times[0] = t_step - t_start;
+    memset(cb.y_block, 0, cb.rcount * sizeof(float));
+    local_spmv(&cb.A, cb.x_block, cb.y_block);
+    step_times[1] = MPI_Wtime() - t_step;
+    t_step = MPI_Wtime();
+    checkerboard_fold(&cb, y_piece);
+    step_times[2] = MPI_Wtime() - t_step;
+    MPI_Barrier(MPI_COMM_WORLD);
+    double elapsed = MPI_Wtime() - t_start;
+    MPI_Reduce(step_times, max_step_times, 3, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    // Values each rank receives in the expand and sends in the fold.
+    int traffic[2] = {cb.ccount - cb.x_count, cb.rcount - cb.y_count}, max_traffic[2];
+    MPI_Reduce(traffic, max_traffic, 2, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+    print_load_report(&cb.A, traffic[0], step_times[1], "2d", load_report, MPI_COMM_WORLD);
+
+    float *y = (float *)malloc(rcount * sizeof(float) + 1);
+    redistribute_range(y_piece, cb.y_start, cb.y_count, y, rstart, rcount, MPI_COMM_WORLD);
+    if (rank == 0)
+        printf("\nVerifying results based on integer portions\n");
+    verify_integer_portion(sequential_y, y, rcount, rstart);
+
     if (rank == 0)
     {
-        global_y = (float *)malloc(global_num_rows * sizeof(float));
-        recvcounts = (int *)malloc(size * sizeof(int));
-        displs = (int *)malloc(size * sizeof(int));
-        for (int p = 0; p < size; p++)
+        printf("Single spMV run took %f seconds, achieving %f GFLOP/s\n", elapsed, 2.0 * num_nonzeros / elapsed / 1e9);
+        printf("\texpand %f, multiply %f, fold %f seconds (slowest rank each)\n", max_step_times[0],
+               max_step_times[1], max_step_times[2]);
+        printf("\tvalues per rank: expand receives at most %d, fold sends at most %d\n", max_traffic[0],
+               max_traffic[1]);
+    }
+
+    free(x_piece);
+    free(y_piece);
+    free(y);
+    checkerboard_free(&cb);
+}
+
+int main(int argc, char **argv)
+{
+    int rank, size;
+    // Rank 0's threads post the --root-read sends concurrently.
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (provided < MPI_THREAD_MULTIPLE && rank == 0)
+        printf("MPI_THREAD_MULTIPLE not provided (level %d); distribution sends come from one thread\n", provided);
+
+    if (argc < 2 || argv[1][0] == '-')
+    {
+        if (rank == 0)
         {
-            int prcount = rows_per_proc + (p < extra ? 1 : 0);
-            recvcounts[p] = prcount;
-            int prstart = p * rows_per_proc + (p < extra ? p : extra);
-            displs[p] = prstart;
+            printf("Give a MatrixMarket file.\n");
+            usage(argc, argv);
         }
+        MPI_Abort(MPI_COMM_WORLD, -1);
     }
-    MPI_Gatherv(local_y, rcount, MPI_FLOAT, global_y, recvcounts, displs, MPI_FLOAT, 0, MPI_COMM_WORLD);
-
-    MPI_Barrier(MPI_COMM_WORLD);
-    double t_end = MPI_Wtime();
+    char *mm_filename = argv[1];
+    int root_read = get_arg(argc, argv, "root-read") != NULL;
 
-    double elapsed = t_end - t_start;
+    coo_matrix global_coo;  //whole matrix, rank 0 with --root-read only
+    coo_matrix local_coo;  //this rank's rows: local row indices, global column indices
+    coo_entry *entries = NULL;  //distributed read: the nonzeros this rank read, before the exchange
+    int num_entries = 0;
+    int global_num_rows, global_num_cols;
+    long long global_nonzeros;
+    int *row_offsets = (int *)malloc((size + 1) * sizeof(int));
+    int *col_offsets = (int *)malloc((size + 1) * sizeof(int));
 
     if (rank == 0)
     {
-        float *sequential_y = (float *)calloc(global_num_rows, sizeof(float));
-        for (int i = 0; i < global_coo.num_nonzeros; i++)
+        printf("Reading matrix from file %s (%s)\n", mm_filename, root_read ? "rank 0" : "MPI-IO, all ranks");
+        fflush(stdout);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t_read = MPI_Wtime();
+    if (root_read)
+    {
+        if (rank == 0)
         {
-            sequential_y[global_coo.rows[i]] += global_coo.vals[i] * x[global_coo.cols[i]];
+            read_coo_matrix(&global_coo, mm_filename);
+            global_num_rows = global_coo.num_rows;
+            global_num_cols = global_coo.num_cols;
+            global_nonzeros = global_coo.num_nonzeros;
         }
+        // Broadcast matrix dimensions to all processes
+        MPI_Bcast(&global_num_rows, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&global_num_cols, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&global_nonzeros, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    }
+    else
+        entries = dist_read_matrix(mm_filename, MPI_COMM_WORLD, &global_num_rows, &global_num_cols, &global_nonzeros,
+                                   &num_entries);
+    double read_time = MPI_Wtime() - t_read;
+
+    // The nonzeros as read, before anything moves them, for the reference
+    // product: a copy of this rank's share, or with --root-read the whole
+    // matrix on rank 0.
+    int num_read = root_read ? (rank == 0 ? global_coo.num_nonzeros : 0) : num_entries;
+    coo_entry *read_entries = (coo_entry *)malloc(num_read * sizeof(coo_entry) + 1);
+    if (root_read)
+    {
+        for (int k = 0; k < num_read; k++)
+        {
+            read_entries[k].row = global_coo.rows[k];
+            read_entries[k].col = global_coo.cols[k];
+            read_entries[k].val = global_coo.vals[k];
+        }
+    }
+    else
+        memcpy(read_entries, entries, num_read * sizeof(coo_entry));
+
+    if (rank == 0)
+    {
+        printf("\nfile=%s rows=%d cols=%d nonzeros=%lld\n", mm_filename, global_num_rows, global_num_cols, global_nonzeros);
+        fflush(stdout);
+    }
+
+    block_row_offsets(global_num_rows, size, row_offsets);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t_distribute = MPI_Wtime();
+    if (root_read)
+    {
+        root_scatter_matrix(row_offsets, &global_coo, &local_coo);
+        local_coo.num_cols = global_num_cols;
+    }
+    else
+        dist_exchange_entries(entries, num_entries, row_offsets, global_num_cols, MPI_COMM_WORLD, &local_coo);
+    double distribute_time = MPI_Wtime() - t_distribute;
+
+    // Per-rank phase times, reduced and reported after the SpMV.
+    phase_timers phases;
+    phase_timers_init(&phases);
+    phase_add(&phases, PHASE_READ, read_time);
+    phase_add(&phases, PHASE_DISTRIBUTE, distribute_time);
 
+    double load_times[2] = {read_time, distribute_time}, max_load_times[2];
+    MPI_Reduce(load_times, max_load_times, 2, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+    {
+        printf("Matrix load took %f seconds (read %f, %s %f)\n", max_load_times[0] + max_load_times[1],
+               max_load_times[0], root_read ? "scatter from rank 0" : "Alltoallv exchange", max_load_times[1]);
+        fflush(stdout);
+    }
+
+    if (get_arg(argc, argv, "2d") != NULL)
+    {
+        float *sequential_y = reference_y(read_entries, num_read, NULL, row_offsets, MPI_COMM_WORLD);
+        checkerboard_spmv(&local_coo, row_offsets, global_num_rows, global_num_cols, global_nonzeros, sequential_y,
+                          get_arg(argc, argv, "load-report") != NULL);
+        if (root_read && rank == 0)
+            delete_coo_matrix(&global_coo);
+        free(sequential_y);
+        free(row_offsets);
+        free(col_offsets);
+        MPI_Finalize();
+        return 0;
+    }
+
+    partition_options part;
+    if (!parse_partition(get_argval(argc, argv, "partition"), &part))
+    {
+        if (rank == 0)
+            printf("Unknown partition %s\n", get_argval(argc, argv, "partition"));
+        MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+    long long predicted_volume = -1;
+    int *perm = NULL;  //hypergraph row numbering
+    if (part.kind != PARTITION_ROWS)
+    {
+        MPI_Barrier(MPI_COMM_WORLD);
+        double t_balance = MPI_Wtime();
+        predicted_volume = balance_rows(&part, &local_coo, row_offsets, global_num_rows, &perm);
+        double balance_time = MPI_Wtime() - t_balance;
+        phase_add(&phases, PHASE_PARTITION, balance_time);
+        if (rank == 0)
+            printf("Partitioning (%s) took %f seconds\n", partition_names[part.kind], balance_time);
+    }
+    int rstart = row_offsets[rank];
+    int rcount = row_offsets[rank + 1] - rstart;
+
+    // Reference product for verification, from the entries as read.
+    float *sequential_y = reference_y(read_entries, num_read, perm, row_offsets, MPI_COMM_WORLD);
+    free(perm);
+
+    // Ghost-column plan: this rank's x holds its owned slice followed by
+    // the remote entries its nonzeros reference.
+    column_offsets(global_num_rows, global_num_cols, row_offsets, size, col_offsets);
+    if (get_arg(argc, argv, "node-shared") != NULL)
+    {
+        char *ranks_per_node = get_argval(argc, argv, "node-shared");
+        node_shared_spmv(&local_coo, col_offsets, rstart, rcount, global_nonzeros, sequential_y,
+                         ranks_per_node != NULL ? atoi(ranks_per_node) : 0, partition_names[part.kind],
+                         get_arg(argc, argv, "load-report") != NULL);
+        if (root_read && rank == 0)
+            delete_coo_matrix(&global_coo);
+        free(sequential_y);
+        free(row_offsets);
+        free(col_offsets);
+        delete_coo_matrix(&local_coo);
+        MPI_Finalize();
+        return 0;
+    }
+    halo_plan halo;
+    int *halo_cols = (int *)malloc(local_coo.num_nonzeros * sizeof(int) + 1);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t_halo_setup = MPI_Wtime();
+    halo_setup(&local_coo, col_offsets, MPI_COMM_WORLD, &halo, halo_cols);
+    double halo_setup_time = MPI_Wtime() - t_halo_setup;
+    phase_add(&phases, PHASE_HALO_SETUP, halo_setup_time);
+    free(local_coo.cols);
+    local_coo.cols = halo_cols;
+    halo_report(&halo, global_num_cols, MPI_COMM_WORLD);
+    if (rank == 0)
+        printf("Halo plan setup took %f seconds\n", halo_setup_time);
+    halo.persistent = get_arg(argc, argv, "persistent") != NULL;
+    if (predicted_volume >= 0)
+    {
+        long long ghosts = halo.num_ghosts, measured_volume;
+        MPI_Reduce(&ghosts, &measured_volume, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (rank == 0)
+            printf("Communication volume: predicted %lld, measured %lld x entries per SpMV\n", predicted_volume,
+                   measured_volume);
+    }
+
+    // x in the halo layout, y over this rank's rows; both stay distributed.
+    dist_vector x, y;
+    dist_vector_create(&x, &halo, MPI_COMM_WORLD);
+    dist_vector_create_range(&y, rstart, rcount, MPI_COMM_WORLD);
+    init_x(&halo, x.data);
+
+    // Interior/boundary split for overlapping the halo with computation,
+    // and a blocking exchange as the reference for how much of it is hidden.
+    int overlap = get_arg(argc, argv, "overlap") != NULL;
+    coo_matrix interior, boundary;
+    double reference_exchange_time = 0;
+    if (overlap)
+    {
+        halo_split(&local_coo, &halo, &interior, &boundary);
+        MPI_Barrier(MPI_COMM_WORLD);
+        double t_reference = MPI_Wtime();
+        dist_vector_update_ghosts(&x);
+        reference_exchange_time = MPI_Wtime() - t_reference;
+        memset(x.data + halo.num_owned, 0, halo.num_ghosts * sizeof(float));
+    }
+
+    // Hardware counters around the local SpMV, one group per OpenMP thread.
+    int count_perf = get_arg(argc, argv, "perf") != NULL;
+    perf_group counters;
+    if (count_perf)
+        perf_group_open(&counters);
+
+    // RAPL energy of the whole timed region, halo exchange and compute.
+    int measure_energy = get_arg(argc, argv, "energy") != NULL;
+    energy_meter energy;
+    if (measure_energy)
+        energy_open(&energy);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t_start = MPI_Wtime();
+    if (measure_energy)
+        energy_start(&energy);
+
+    double t_exchange = MPI_Wtime();
+    if (overlap)
+        halo_begin(&halo, x.data);
+    else
+        dist_vector_update_ghosts(&x);
+    double exchange_time = MPI_Wtime() - t_exchange;
+
+    if (count_perf)
+        perf_group_start(&counters);
+    double t_compute = MPI_Wtime();
+    if (overlap)
+        interior_spmv(&interior, x.data, y.data, &halo);
+    else
+        local_spmv(&local_coo, x.data, y.data);
+    double compute_time = MPI_Wtime() - t_compute;
+    if (count_perf)
+        perf_group_stop(&counters);
+
+    if (overlap)
+    {
+        // Wait for whatever the interior did not hide, then the ghost columns.
+        t_exchange = MPI_Wtime();
+        halo_end(&halo);
+        exchange_time += MPI_Wtime() - t_exchange;
+        if (count_perf)
+            perf_group_start(&counters);
+        t_compute = MPI_Wtime();
+        local_spmv(&boundary, x.data, y.data);
+        compute_time += MPI_Wtime() - t_compute;
+        if (count_perf)
+            perf_group_stop(&counters);
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (measure_energy)
+        energy_stop(&energy);
+    double t_end = MPI_Wtime();
+
+    double elapsed = t_end - t_start;
+
+    if (count_perf)
+        perf_group_reduce(&counters, 0, MPI_COMM_WORLD);
+    if (measure_energy)
+        energy_reduce(&energy, 0, MPI_COMM_WORLD);
+    phase_add(&phases, PHASE_EXCHANGE, exchange_time);
+    phase_add(&phases, PHASE_COMPUTE, compute_time);
+    double exchange_times[2] = {exchange_time, reference_exchange_time}, max_exchange_times[2];
+    MPI_Reduce(exchange_times, max_exchange_times, 2, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    long long interior_nonzeros = overlap ? interior.num_nonzeros : 0, total_interior;
+    MPI_Reduce(&interior_nonzeros, &total_interior, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    print_load_report(&local_coo, halo.num_ghosts, compute_time, partition_names[part.kind],
+                      get_arg(argc, argv, "load-report") != NULL, MPI_COMM_WORLD);
+
+    if (rank == 0)
         printf("\nVerifying results based on integer portions\n");
-        verify_integer_portion(sequential_y, global_y, global_num_rows);
-        double total_flops = 2.0 * global_coo.num_nonzeros;
+    verify_integer_portion(sequential_y, y.data, rcount, rstart);
+
+    if (rank == 0)
+    {
+        double total_flops = 2.0 * global_nonzeros;
         double gflops = (total_flops / elapsed) / 1e9;
         printf("Single spMV run took %f seconds, achieving %f GFLOP/s\n", elapsed, gflops);
+        if (overlap)
+        {
+            // Share of the blocking exchange time that the interior hid.
+            double hidden = max_exchange_times[1] > 0 ? 1 - max_exchange_times[0] / max_exchange_times[1] : 1;
+            printf("\thalo exchange exposed %f of %f seconds blocking (slowest rank): %.1f%% overlapped\n",
+                   max_exchange_times[0], max_exchange_times[1], 100 * (hidden > 0 ? hidden : 0));
+            printf("\tinterior: %lld of %lld nonzeros (%.1f%%) computed while the halo is in flight\n", total_interior,
+                   global_nonzeros, 100.0 * total_interior / global_nonzeros);
+        }
+        else
+            printf("\thalo exchange took %f seconds (slowest rank)\n", max_exchange_times[0]);
+        if (count_perf)
+        {
+            perf_group_report_unavailable(&counters);
+            perf_group_print(&counters, "local SpMV (all ranks)", global_nonzeros, "nnz");
+        }
+        if (measure_energy)
+        {
+            energy_report_unavailable(&energy);
+            energy_print(&energy, "SpMV (all nodes)", total_flops);
+        }
+        if (root_read)
+            delete_coo_matrix(&global_coo);
+    }
 
+    // Optional output step: the whole y on rank 0.
+    if (get_arg(argc, argv, "gather") != NULL)
+    {
+        float *global_y = rank == 0 ? (float *)malloc(global_num_rows * sizeof(float) + 1) : NULL;
+        MPI_Barrier(MPI_COMM_WORLD);
+        double t_gather = MPI_Wtime();
+        dist_vector_gather(&y, global_y, 0);
+        double gather_time = MPI_Wtime() - t_gather;
+        phase_add(&phases, PHASE_GATHER, gather_time);
+        if (rank == 0)
+            printf("Gathering y on rank 0 took %f seconds\n", gather_time);
         free(global_y);
-        free(recvcounts);
-        free(displs);
-        delete_coo_matrix(&global_coo);
-        free(x);
     }
-    free(local_y);
-    if (rank != 0)
-        free(x);
-    if (local_rows)
-        free(local_rows);
-    if (local_cols)
-        free(local_cols);
-    if (local_vals)
-        free(local_vals);
+    phase_report(&phases, get_arg(argc, argv, "phases") != NULL, MPI_COMM_WORLD);
+
+    char *iterations = get_argval(argc, argv, "iterations");
+    if (iterations != NULL && atoi(iterations) > 0)
+    {
+        if (global_num_rows == global_num_cols)
+            power_iteration(&local_coo, &x, &y, atoi(iterations), global_nonzeros);
+        else if (rank == 0)
+            printf("Power iteration needs a square matrix\n");
+    }
+
+    char *halo_bench = get_argval(argc, argv, "halo-bench");
+    if (halo_bench != NULL && atoi(halo_bench) > 0)
+        halo_benchmark(&local_coo, &halo, atoi(halo_bench));
+
+    char *cg = get_argval(argc, argv, "cg");
+    if (cg != NULL && atoi(cg) > 0)
+    {
+        char *tolerance = strchr(cg, ',');
+        if (global_num_rows == global_num_cols)
+            cg_compare(&local_coo, &halo, atoi(cg), tolerance != NULL ? atof(tolerance + 1) : CG_TOLERANCE);
+        else if (rank == 0)
+            printf("CG needs a square matrix\n");
+    }
+
+    free(sequential_y);
+    dist_vector_free(&x);
+    dist_vector_free(&y);
+    free(row_offsets);
+    free(col_offsets);
+    halo_free(&halo);
+    delete_coo_matrix(&local_coo);
+    if (overlap)
+    {
+        delete_coo_matrix(&interior);
+        delete_coo_matrix(&boundary);
+    }
+
+    if (count_perf)
+        perf_group_close(&counters);
 
     MPI_Finalize();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,393 @@
+#pragma once
+
+// Distributed matrix loading: every rank reads its own byte range of the
+// file with MPI-IO, then one MPI_Alltoallv sends each nonzero to the rank
+// that owns its row. No rank ever holds more than its share of the matrix.
+//
+// MatrixMarket: rank 0 parses the banner and size line; the data lines are
+// split by bytes and a line belongs to the rank whose range holds its first
+// byte. Binary COO (matgen): the nonzeros are split evenly by index.
+// Include after mpi.h.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include "formats.h"
+#include "input.h"
+#include "mmio.h"
+
+// Longest data line we expect; a rank reads this far past its range to
+// finish the last line it owns.
+#define DIST_MAX_LINE 1024
+
+// Largest single MPI-IO read; a rank's byte range can pass 2 GiB but MPI
+// counts are int.
+#ifndef DIST_READ_PIECE
+#define DIST_READ_PIECE INT_MAX
+#endif
+
+typedef struct coo_entry
+{
+    int row, col;
+    float val;
+} coo_entry;
+
+typedef struct dist_file_info
+{
+    int binary, pattern, symmetric;
+    long long num_rows, num_cols, num_nonzeros;  //as stored (before symmetric expansion)
+    long long data_offset;  //first byte of the nonzeros
+    long long file_size;
+} dist_file_info;
+
+// Rank 0 reads the header; everyone gets the result. Aborts on bad files.
+static void dist_read_header(const char *filename, MPI_Comm comm, dist_file_info *info)
+{
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    if (rank == 0)
+    {
+        FILE *fid = fopen(filename, "rb");
+        if (fid == NULL)
+        {
+            printf("Unable to open file %s\n", filename);
+            MPI_Abort(comm, 1);
+        }
+        memset(info, 0, sizeof(*info));
+
+        coo_binary_header header;
+        if (fread(&header, sizeof(header), 1, fid) == 1 && memcmp(header.magic, COO_BINARY_MAGIC, 8) == 0)
+        {
+            info->binary = 1;
+            info->num_rows = header.num_rows;
+            info->num_cols = header.num_cols;
+            info->num_nonzeros = header.num_nonzeros;
+            info->data_offset = sizeof(header);
+        }
+        else
+        {
+            MM_typecode matcode;
+            int rows, cols, nnz;
+            rewind(fid);
+            if (mm_read_banner(fid, &matcode) != 0 || !mm_is_coordinate(matcode) ||
+                !(mm_is_real(matcode) || mm_is_integer(matcode) || mm_is_pattern(matcode)) ||
+                mm_read_mtx_crd_size(fid, &rows, &cols, &nnz) != 0)
+            {
+                printf("Only sparse real-valued or pattern coordinate matrices are supported (%s)\n", filename);
+                MPI_Abort(comm, 1);
+            }
+            info->pattern = mm_is_pattern(matcode) != 0;
+            info->symmetric = mm_is_symmetric(matcode) != 0;
+            info->num_rows = rows;
+            info->num_cols = cols;
+            info->num_nonzeros = nnz;
+            info->data_offset = ftell(fid);
+        }
+        fseek(fid, 0, SEEK_END);
+        info->file_size = ftell(fid);
+        fclose(fid);
+    }
+
+    MPI_Bcast(info, sizeof(*info), MPI_BYTE, 0, comm);
+}
+
+// Parse the MatrixMarket lines that start inside [lo, hi) of the file.
+static coo_entry *dist_parse_mtx_range(MPI_File fh, const dist_file_info *info, long long lo, long long hi,
+                                       int *count)
+{
+    // One byte before lo tells whether lo starts a line; DIST_MAX_LINE after
+    // hi finishes the last line.
+    long long begin = lo > info->data_offset ? lo - 1 : lo;
+    long long end = hi + DIST_MAX_LINE < info->file_size ? hi + DIST_MAX_LINE : info->file_size;
+    MPI_Offset len = end - begin;
+    char *buf = (char *)malloc((size_t)len + 1);
+    MPI_Offset done = 0;
+    while (done < len)
+    {
+        int piece = len - done < DIST_READ_PIECE ? (int)(len - done) : DIST_READ_PIECE, got;
+        MPI_Status status;
+        MPI_File_read_at(fh, begin + done, buf + done, piece, MPI_CHAR, &status);
+        MPI_Get_count(&status, MPI_CHAR, &got);
+        if (got <= 0)
+            break;
+        done += got;
+    }
+    buf[done] = '\0';
+
+    // Skip the tail of a line that started in the previous rank's range.
+    char *p = buf;
+    if (begin < lo && buf[0] != '\n')
+    {
+        while (*p && *p != '\n')
+            p++;
+    }
+    if (begin < lo && *p)
+        p++;
+
+    // First guess of one entry per 8 bytes, grown as needed, but never above
+    // the file's nonzero count.
+    long long capacity = (hi - lo) / 8 < info->num_nonzeros ? (hi - lo) / 8 : info->num_nonzeros;
+    capacity += 16;
+    int n = 0;
+    coo_entry *entries = (coo_entry *)malloc((size_t)capacity * sizeof(coo_entry));
+    while (*p && begin + (p - buf) < hi)
+    {
+        char *next = p;
+        while (*next == ' ' || *next == '\t')
+            next++;
+        if (*next < '0' || *next > '9')  //blank line
+        {
+            while (*p && *p != '\n')
+                p++;
+            if (*p)
+                p++;
+            continue;
+        }
+        long i = strtol(next, &next, 10);
+        long j = strtol(next, &next, 10);
+        double v = info->pattern ? 1.0 : strtod(next, &next);
+        if (n == capacity)
+            entries = (coo_entry *)realloc(entries, (size_t)(capacity *= 2) * sizeof(coo_entry));
+        entries[n].row = (int)i - 1;
+        entries[n].col = (int)j - 1;
+        entries[n].val = (float)v;
+        n++;
+        p = next;
+        while (*p && *p != '\n')
+            p++;
+        if (*p)
+            p++;
+    }
+
+    free(buf);
+    *count = n;
+    return entries;
+}
+
+// Read this rank's share of the nonzeros (global indices, 0-based, symmetric
+// matrices expanded). Returns the entries; sets the global shape and the
+// global nonzero count after expansion.
+coo_entry *dist_read_matrix(const char *filename, MPI_Comm comm, int *num_rows, int *num_cols,
+                            long long *num_nonzeros, int *count)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    dist_file_info info;
+    dist_read_header(filename, comm, &info);
+    if (info.num_rows > INT_MAX || info.num_cols > INT_MAX || info.num_nonzeros > INT_MAX)
+    {
+        if (rank == 0)
+            printf("Matrix in %s is too large for 32-bit indexing\n", filename);
+        MPI_Abort(comm, 1);
+    }
+    *num_rows = (int)info.num_rows;
+    *num_cols = (int)info.num_cols;
+
+    MPI_File fh;
+    if (MPI_File_open(comm, (char *)filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+    {
+        if (rank == 0)
+            printf("MPI-IO could not open %s\n", filename);
+        MPI_Abort(comm, 1);
+    }
+
+    coo_entry *entries;
+    int n;
+    if (info.binary)
+    {
+        long long first = info.num_nonzeros * rank / size;
+        n = (int)(info.num_nonzeros * (rank + 1) / size - first);
+        int *rows = (int *)malloc(n * sizeof(int) + 1);
+        int *cols = (int *)malloc(n * sizeof(int) + 1);
+        float *vals = (float *)malloc(n * sizeof(float) + 1);
+        MPI_Offset rows_pos = info.data_offset + first * sizeof(int);
+        MPI_Offset cols_pos = rows_pos + info.num_nonzeros * sizeof(int);
+        MPI_Offset vals_pos = cols_pos + info.num_nonzeros * sizeof(int);
+        MPI_File_read_at_all(fh, rows_pos, rows, n, MPI_INT, MPI_STATUS_IGNORE);
+        MPI_File_read_at_all(fh, cols_pos, cols, n, MPI_INT, MPI_STATUS_IGNORE);
+        MPI_File_read_at_all(fh, vals_pos, vals, n, MPI_FLOAT, MPI_STATUS_IGNORE);
+
+        entries = (coo_entry *)malloc(n * sizeof(coo_entry) + 1);
+        for (int k = 0; k < n; k++)
+        {
+            entries[k].row = rows[k];
+            entries[k].col = cols[k];
+            entries[k].val = vals[k];
+        }
+        free(rows);
+        free(cols);
+        free(vals);
+    }
+    else
+    {
+        long long bytes = info.file_size - info.data_offset;
+        long long lo = info.data_offset + bytes * rank / size;
+        long long hi = info.data_offset + bytes * (rank + 1) / size;
+        entries = dist_parse_mtx_range(fh, &info, lo, hi, &n);
+    }
+    MPI_File_close(&fh);
+
+    long long stored = n, total_stored;
+    MPI_Allreduce(&stored, &total_stored, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    if (total_stored != info.num_nonzeros)
+    {
+        if (rank == 0)
+            printf("Read %lld nonzeros from %s but the header says %lld\n", total_stored, filename, info.num_nonzeros);
+        MPI_Abort(comm, 1);
+    }
+
+    if (info.symmetric)
+    {
+        int off_diagonals = 0;
+        for (int k = 0; k < n; k++)
+            if (entries[k].row != entries[k].col)
+                off_diagonals++;
+        entries = (coo_entry *)realloc(entries, (n + off_diagonals) * sizeof(coo_entry) + 1);
+        for (int k = 0, m = n; k < n; k++)
+            if (entries[k].row != entries[k].col)
+            {
+                entries[m].row = entries[k].col;
+                entries[m].col = entries[k].row;
+                entries[m].val = entries[k].val;
+                m++;
+            }
+        n += off_diagonals;
+    }
+
+    long long local = n;
+    MPI_Allreduce(&local, num_nonzeros, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    *count = n;
+    return entries;
+}
+
+// Equal row blocks, the first num_rows % size ranks getting one extra row.
+// row_offsets has size + 1 entries.
+void block_row_offsets(int num_rows, int size, int *row_offsets)
+{
+    int rows_per_proc = num_rows / size, extra = num_rows % size;
+    for (int p = 0; p <= size; p++)
+        row_offsets[p] = p * rows_per_proc + (p < extra ? p : extra);
+}
+
+// Rank owning global row r under row_offsets.
+static int row_owner(const int *row_offsets, int size, int r)
+{
+    int lo = 0, hi = size - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (row_offsets[mid] <= r)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+// Send entries[k] to rank dest[k] with one MPI_Alltoallv. Returns the
+// entries this rank receives, grouped by source rank. Frees entries.
+coo_entry *dist_send_entries(coo_entry *entries, int n, const int *dest, MPI_Comm comm, int *num_recv)
+{
+    int size;
+    MPI_Comm_size(comm, &size);
+
+    int *send_counts = (int *)calloc(size, sizeof(int));
+    int *recv_counts = (int *)malloc(size * sizeof(int));
+    int *send_displs = (int *)malloc(size * sizeof(int));
+    int *recv_displs = (int *)malloc(size * sizeof(int));
+    for (int k = 0; k < n; k++)
+        send_counts[dest[k]]++;
+    MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, comm);
+
+    int total = 0;
+    for (int p = 0; p < size; p++)
+    {
+        send_displs[p] = p == 0 ? 0 : send_displs[p - 1] + send_counts[p - 1];
+        recv_displs[p] = total;
+        total += recv_counts[p];
+    }
+
+    // Bucket the entries by destination.
+    coo_entry *send = (coo_entry *)malloc(n * sizeof(coo_entry) + 1);
+    int *next = (int *)malloc(size * sizeof(int));
+    memcpy(next, send_displs, size * sizeof(int));
+    for (int k = 0; k < n; k++)
+        send[next[dest[k]]++] = entries[k];
+    free(entries);
+
+    MPI_Datatype entry_type;
+    int lengths[3] = {1, 1, 1};
+    MPI_Aint offsets[3] = {offsetof(coo_entry, row), offsetof(coo_entry, col), offsetof(coo_entry, val)};
+    MPI_Datatype types[3] = {MPI_INT, MPI_INT, MPI_FLOAT};
+    MPI_Type_create_struct(3, lengths, offsets, types, &entry_type);
+    MPI_Type_commit(&entry_type);
+
+    coo_entry *recv = (coo_entry *)malloc(total * sizeof(coo_entry) + 1);
+    MPI_Alltoallv(send, send_counts, send_displs, entry_type, recv, recv_counts, recv_displs, entry_type, comm);
+    MPI_Type_free(&entry_type);
+
+    free(send);
+    free(next);
+    free(send_counts);
+    free(recv_counts);
+    free(send_displs);
+    free(recv_displs);
+    *num_recv = total;
+    return recv;
+}
+
+// Build a COO block from entries of rows [rstart, rstart + num_rows) and
+// columns [cstart, cstart + num_cols), with indices relative to the block
+// and sorted by row. A counting sort on the row keeps the order within each
+// row. Frees entries.
+void entries_to_local_coo(coo_entry *entries, int n, int rstart, int num_rows, int cstart, int num_cols,
+                          coo_matrix *local)
+{
+    local->num_rows = num_rows;
+    local->num_cols = num_cols;
+    local->num_nonzeros = n;
+    local->rows = (int *)malloc(n * sizeof(int) + 1);
+    local->cols = (int *)malloc(n * sizeof(int) + 1);
+    local->vals = (float *)malloc(n * sizeof(float) + 1);
+
+    int *row_start = (int *)calloc(num_rows + 1, sizeof(int));
+    for (int k = 0; k < n; k++)
+        row_start[entries[k].row - rstart + 1]++;
+    for (int i = 0; i < num_rows; i++)
+        row_start[i + 1] += row_start[i];
+    for (int k = 0; k < n; k++)
+    {
+        int dst = row_start[entries[k].row - rstart]++;
+        local->rows[dst] = entries[k].row - rstart;
+        local->cols[dst] = entries[k].col - cstart;
+        local->vals[dst] = entries[k].val;
+    }
+
+    free(row_start);
+    free(entries);
+}
+
+// Send every entry to the owner of its row and build this rank's rows as a
+// COO matrix sorted by row, with row indices local to the block and column
+// indices global. Frees entries.
+void dist_exchange_entries(coo_entry *entries, int n, const int *row_offsets, int num_cols, MPI_Comm comm,
+                           coo_matrix *local)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    int *dest = (int *)malloc(n * sizeof(int) + 1);
+    for (int k = 0; k < n; k++)
+        dest[k] = row_owner(row_offsets, size, entries[k].row);
+    int num_recv;
+    coo_entry *recv = dist_send_entries(entries, n, dest, comm, &num_recv);
+    free(dest);
+
+    int rstart = row_offsets[rank], rcount = row_offsets[rank + 1] - rstart;
+    entries_to_local_coo(recv, num_recv, rstart, rcount, 0, num_cols, local);
+}
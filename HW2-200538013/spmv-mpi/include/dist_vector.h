@@ -0,0 +1,135 @@
+#pragma once
+
+// Distributed vector: each rank holds the entries [start, start + count) of
+// a global vector, optionally followed by a ghost copy of the remote entries
+// a halo plan brings in. Reductions (dot, norm) are one MPI_Allreduce every
+// rank takes part in, updates (axpy, scale, copy) are purely local, so
+// iterating on such vectors never goes through a root. Gathering the whole
+// vector on one rank is a separate, explicit output step. Include after
+// mpi.h.
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "halo.h"
+
+typedef struct dist_vector
+{
+    MPI_Comm comm;
+    int start, count;  //owned global range
+    int num_ghosts;
+    float *data;  //count owned entries, then num_ghosts ghosts
+    halo_plan *plan;  //fills the ghosts; NULL for a vector without any
+    halo_persistent *persistent;  //requests bound to data, if the plan asks for them
+} dist_vector;
+
+// Vector laid out like a halo plan's x: owned slice plus its ghosts. With
+// plan->persistent set, its ghost updates use persistent requests created
+// here for its buffer.
+void dist_vector_create(dist_vector *v, halo_plan *plan, MPI_Comm comm)
+{
+    v->comm = comm;
+    v->start = plan->cstart;
+    v->count = plan->num_owned;
+    v->num_ghosts = plan->num_ghosts;
+    v->plan = plan;
+    v->data = (float *)calloc(v->count + v->num_ghosts + 1, sizeof(float));
+    v->persistent = NULL;
+    if (plan->persistent)
+    {
+        v->persistent = (halo_persistent *)malloc(sizeof(halo_persistent));
+        halo_persistent_init(plan, v->data, v->persistent);
+    }
+}
+
+// Vector owning [start, start + count) with no ghost part (e.g. y = A x).
+void dist_vector_create_range(dist_vector *v, int start, int count, MPI_Comm comm)
+{
+    v->comm = comm;
+    v->start = start;
+    v->count = count;
+    v->num_ghosts = 0;
+    v->plan = NULL;
+    v->persistent = NULL;
+    v->data = (float *)calloc(count + 1, sizeof(float));
+}
+
+void dist_vector_free(dist_vector *v)
+{
+    if (v->persistent != NULL)
+    {
+        halo_persistent_free(v->persistent);
+        free(v->persistent);
+    }
+    free(v->data);
+}
+
+// Refresh the ghost entries from their owners.
+void dist_vector_update_ghosts(dist_vector *v)
+{
+    if (v->persistent != NULL)
+        halo_persistent_exchange(v->persistent);
+    else if (v->plan != NULL)
+        halo_exchange(v->plan, v->data);
+}
+
+// This rank's share of a . b (owned entries, summed in double), for
+// callers that reduce several dots together or without blocking.
+double dist_local_dot(const dist_vector *a, const dist_vector *b)
+{
+    double local = 0;
+    for (int i = 0; i < a->count; i++)
+        local += (double)a->data[i] * b->data[i];
+    return local;
+}
+
+// a and b must share the distribution.
+double dist_dot(const dist_vector *a, const dist_vector *b)
+{
+    double local = dist_local_dot(a, b), global;
+    MPI_Allreduce(&local, &global, 1, MPI_DOUBLE, MPI_SUM, a->comm);
+    return global;
+}
+
+double dist_norm(const dist_vector *v)
+{
+    return sqrt(dist_dot(v, v));
+}
+
+// y += alpha x on the owned entries.
+void dist_axpy(float alpha, const dist_vector *x, dist_vector *y)
+{
+    for (int i = 0; i < y->count; i++)
+        y->data[i] += alpha * x->data[i];
+}
+
+void dist_scale(float alpha, dist_vector *v)
+{
+    for (int i = 0; i < v->count; i++)
+        v->data[i] *= alpha;
+}
+
+// Owned entries of src into dst; ghosts of dst are stale until updated.
+void dist_copy(const dist_vector *src, dist_vector *dst)
+{
+    memcpy(dst->data, src->data, src->count * sizeof(float));
+}
+
+// Collect the whole vector on root (global has room for every entry there,
+// may be NULL elsewhere). Ranks' ranges must tile the vector in rank order.
+void dist_vector_gather(const dist_vector *v, float *global, int root)
+{
+    int rank, size;
+    MPI_Comm_rank(v->comm, &rank);
+    MPI_Comm_size(v->comm, &size);
+    int *counts = NULL, *displs = NULL;
+    if (rank == root)
+    {
+        counts = (int *)malloc(size * sizeof(int));
+        displs = (int *)malloc(size * sizeof(int));
+    }
+    MPI_Gather(&v->count, 1, MPI_INT, counts, 1, MPI_INT, root, v->comm);
+    MPI_Gather(&v->start, 1, MPI_INT, displs, 1, MPI_INT, root, v->comm);
+    MPI_Gatherv(v->data, v->count, MPI_FLOAT, global, counts, displs, MPI_FLOAT, root, v->comm);
+    free(counts);
+    free(displs);
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+// Package and DRAM energy from the RAPL zones under /sys/class/powercap
+// (intel-rapl:N is package N, intel-rapl:N:M its subzones; AMD parts expose
+// the same layout). Energy accumulates across start/stop pairs until
+// energy_reset. The counters wrap at max_energy_range_uj, which is corrected
+// for once per start/stop pair. If no zone is readable (no RAPL, a VM, or
+// energy_uj being root-only) the meter is unavailable and printing is a
+// no-op; energy_report_unavailable says why.
+//
+// In MPI programs include this after mpi.h to get energy_reduce.
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+
+#ifndef ENERGY_POWERCAP_DIR
+#define ENERGY_POWERCAP_DIR "/sys/class/powercap"
+#endif
+#define ENERGY_MAX_DOMAINS 16
+
+typedef struct energy_meter
+{
+    int num_domains;
+    char names[ENERGY_MAX_DOMAINS][32];  //"package-0", "dram-0", ...
+    char paths[ENERGY_MAX_DOMAINS][320];  //energy_uj file of each domain
+    unsigned long long max_range[ENERGY_MAX_DOMAINS];  //value (uJ) the counter wraps at, 0 if unknown
+    unsigned long long start[ENERGY_MAX_DOMAINS];
+    double joules[ENERGY_MAX_DOMAINS];  //accumulated since the last reset
+    double seconds;  //wall time accumulated over the same start/stop pairs
+    struct timespec started;
+    int available;  //1 if at least one domain is readable
+    char error[160];  //why the meter is unavailable
+} energy_meter;
+
+static int energy_read_ull(const char *path, unsigned long long *value)
+{
+    FILE *fid = fopen(path, "r");
+    if (fid == NULL)
+        return 0;
+    int ok = fscanf(fid, "%llu", value) == 1;
+    fclose(fid);
+    return ok;
+}
+
+static int cmp_energy_zones(const void *a, const void *b)
+{
+    return strcmp((const char *)a, (const char *)b);
+}
+
+void energy_reset(energy_meter *m)
+{
+    for (int d = 0; d < m->num_domains; d++)
+        m->joules[d] = 0;
+    m->seconds = 0;
+}
+
+// Find the package and DRAM zones. Returns 1 if energy can be measured.
+int energy_open(energy_meter *m)
+{
+    m->num_domains = 0;
+    m->available = 0;
+    m->error[0] = '\0';
+
+    DIR *dir = opendir(ENERGY_POWERCAP_DIR);
+    if (dir == NULL)
+    {
+        snprintf(m->error, sizeof(m->error), "%s: %s", ENERGY_POWERCAP_DIR, strerror(errno));
+        return 0;
+    }
+
+    // Zone directories in name order, so packages come before their subzones.
+    char zones[64][64];
+    int num_zones = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL && num_zones < 64)
+        if (strstr(ent->d_name, "rapl:") != NULL && strlen(ent->d_name) < sizeof(zones[0]))
+            strcpy(zones[num_zones++], ent->d_name);
+    closedir(dir);
+    qsort(zones, num_zones, sizeof(zones[0]), cmp_energy_zones);
+
+    for (int z = 0; z < num_zones && m->num_domains < ENERGY_MAX_DOMAINS; z++)
+    {
+        char path[320], name[32] = "";
+        snprintf(path, sizeof(path), "%s/%.63s/name", ENERGY_POWERCAP_DIR, zones[z]);
+        FILE *fid = fopen(path, "r");
+        if (fid == NULL || fscanf(fid, "%31s", name) != 1)
+        {
+            if (fid)
+                fclose(fid);
+            continue;
+        }
+        fclose(fid);
+
+        int d = m->num_domains;
+        const char *package = strchr(zones[z], ':') + 1;  //"N" or "N:M"
+        if (strncmp(name, "package", 7) == 0)
+            snprintf(m->names[d], sizeof(m->names[d]), "%s", name);
+        else if (strcmp(name, "dram") == 0)
+            snprintf(m->names[d], sizeof(m->names[d]), "dram-%d", atoi(package));
+        else
+            continue;  //core, uncore and psys overlap the package total
+
+        unsigned long long uj;
+        snprintf(m->paths[d], sizeof(m->paths[d]), "%s/%.63s/energy_uj", ENERGY_POWERCAP_DIR, zones[z]);
+        if (!energy_read_ull(m->paths[d], &uj))
+        {
+            snprintf(m->error, sizeof(m->error), "%s: %s", m->paths[d], strerror(errno));
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%.63s/max_energy_range_uj", ENERGY_POWERCAP_DIR, zones[z]);
+        if (!energy_read_ull(path, &m->max_range[d]))
+            m->max_range[d] = 0;
+        m->num_domains++;
+    }
+
+    if (m->num_domains > 0)
+        m->available = 1;
+    else if (m->error[0] == '\0')
+        snprintf(m->error, sizeof(m->error), "no RAPL package or DRAM zones in %s", ENERGY_POWERCAP_DIR);
+
+    energy_reset(m);
+    return m->available;
+}
+
+void energy_start(energy_meter *m)
+{
+    if (!m->available)
+        return;
+    for (int d = 0; d < m->num_domains; d++)
+        energy_read_ull(m->paths[d], &m->start[d]);
+    clock_gettime(CLOCK_MONOTONIC, &m->started);
+}
+
+void energy_stop(energy_meter *m)
+{
+    if (!m->available)
+        return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    m->seconds += (now.tv_sec - m->started.tv_sec) + 1e-9 * (now.tv_nsec - m->started.tv_nsec);
+
+    for (int d = 0; d < m->num_domains; d++)
+    {
+        unsigned long long end;
+        if (!energy_read_ull(m->paths[d], &end))
+            continue;
+        if (end >= m->start[d])
+            m->joules[d] += (end - m->start[d]) * 1e-6;
+        else if (m->max_range[d] > m->start[d])  //wrapped once
+            m->joules[d] += (m->max_range[d] - m->start[d] + end) * 1e-6;
+    }
+}
+
+// One line per region: energy per domain, total, average power and, when
+// flops > 0, GFLOP per joule.
+void energy_print(const energy_meter *m, const char *region, double flops)
+{
+    if (!m->available)
+        return;
+
+    double total = 0;
+    printf("[energy] %s:", region);
+    for (int d = 0; d < m->num_domains; d++)
+    {
+        printf(" %s=%.4f J", m->names[d], m->joules[d]);
+        total += m->joules[d];
+    }
+    printf(" total=%.4f J", total);
+    if (m->seconds > 0)
+        printf(" avg=%.2f W", total / m->seconds);
+    if (flops > 0 && total > 0)
+        printf(" %.4f GFLOP/J", flops / 1e9 / total);
+    printf("\n");
+}
+
+// Print why energy is not reported, once, from the caller's chosen rank.
+void energy_report_unavailable(const energy_meter *m)
+{
+    if (!m->available)
+        printf("[energy] RAPL energy unavailable (%s); energy not reported\n", m->error);
+}
+
+#ifdef MPI_VERSION
+// Sum the energy of every node into root's meter. Ranks sharing a node read
+// the same counters, so only the first rank on each node contributes; nodes
+// are assumed to expose the same domains. Time is the longest on any rank.
+void energy_reduce(energy_meter *m, int root, MPI_Comm comm)
+{
+    MPI_Comm node_comm;
+    int node_rank, rank;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_free(&node_comm);
+    MPI_Comm_rank(comm, &rank);
+
+    double joules[ENERGY_MAX_DOMAINS] = {0}, totals[ENERGY_MAX_DOMAINS];
+    if (node_rank == 0 && m->available)
+        for (int d = 0; d < m->num_domains; d++)
+            joules[d] = m->joules[d];
+    int available = m->available, all_available;
+    double seconds = m->seconds;
+
+    MPI_Reduce(joules, totals, ENERGY_MAX_DOMAINS, MPI_DOUBLE, MPI_SUM, root, comm);
+    MPI_Reduce(&available, &all_available, 1, MPI_INT, MPI_MIN, root, comm);
+    MPI_Reduce(&seconds, &m->seconds, 1, MPI_DOUBLE, MPI_MAX, root, comm);
+
+    if (rank != root)
+        return;
+    for (int d = 0; d < m->num_domains; d++)
+        m->joules[d] = totals[d];
+    if (!all_available && m->available)
+        snprintf(m->error, sizeof(m->error), "not readable on every node");
+    m->available = all_available;
+}
+#endif
@@ -0,0 +1,303 @@
+#pragma once
+
+// Ghost-column exchange for the distributed SpMV. x is distributed like the
+// columns (col_offsets); a rank owns x[cstart, cstart + num_owned) and keeps
+// a ghost copy of just the remote entries its nonzeros reference. The plan
+// is built once: ranks tell each owner which of its entries they need, and
+// a distributed-graph communicator connects every rank to exactly the ranks
+// it exchanges with. Each SpMV then moves only the ghost entries with one
+// MPI_Neighbor_alltoallv, or with point-to-point Isend/Irecv posted by
+// halo_begin and completed by halo_end so that work on owned entries can
+// run while the ghosts travel. For repeated exchanges into the same x,
+// halo_persistent creates the requests once and only starts them. Include
+// after mpi.h.
+#include <stdio.h>
+#include <stdlib.h>
+#include "formats.h"
+#include "dist_input.h"
+
+typedef struct halo_plan
+{
+    MPI_Comm graph;  //sources: owners of our ghosts; destinations: ranks needing our entries
+    int cstart, num_owned;  //owned slice of x
+    int num_ghosts;
+    int *ghost_cols;  //global column of each ghost, ascending (so grouped by owner)
+    int num_sources, *sources, *recv_counts, *recv_displs;  //ghost slots filled by each source
+    int num_dests, *dests, *send_counts, *send_displs;  //slices of send_index per destination
+    int num_send;
+    int *send_index;  //owned offsets to pack, in destination order
+    float *send_buf;
+    MPI_Request *requests;  //num_sources receives, then num_dests sends
+    int persistent;  //dist_vectors created on this plan bind persistent requests
+} halo_plan;
+
+// Persistent requests of a plan bound to one x buffer.
+typedef struct halo_persistent
+{
+    halo_plan *plan;
+    float *x;
+    int num_requests;
+    MPI_Request *requests;
+} halo_persistent;
+
+static int cmp_halo_ints(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Sort cols[0 .. n) and drop duplicates; returns the distinct count.
+static int sort_unique_ints(int *cols, int n)
+{
+    qsort(cols, n, sizeof(int), cmp_halo_ints);
+    int m = 0;
+    for (int k = 0; k < n; k++)
+        if (m == 0 || cols[k] != cols[m - 1])
+            cols[m++] = cols[k];
+    return m;
+}
+
+// Build the plan that fills the given ghosts (distinct remote columns,
+// ascending; the plan takes over the array) from their owners.
+void halo_setup_ghosts(int *ghost_cols, int num_ghosts, const int *col_offsets, MPI_Comm comm, halo_plan *plan)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int cstart = col_offsets[rank];
+    plan->cstart = cstart;
+    plan->num_owned = col_offsets[rank + 1] - cstart;
+    plan->num_ghosts = num_ghosts;
+    plan->ghost_cols = ghost_cols;
+    plan->persistent = 0;
+
+    // Tell every owner which of its entries we need.
+    int *want = (int *)calloc(size, sizeof(int));
+    int *asked = (int *)malloc(size * sizeof(int));
+    int *want_displs = (int *)malloc(size * sizeof(int));
+    int *asked_displs = (int *)malloc(size * sizeof(int));
+    for (int g = 0; g < num_ghosts; g++)
+        want[row_owner(col_offsets, size, plan->ghost_cols[g])]++;
+    MPI_Alltoall(want, 1, MPI_INT, asked, 1, MPI_INT, comm);
+    int num_send = 0;
+    for (int p = 0; p < size; p++)
+    {
+        want_displs[p] = p == 0 ? 0 : want_displs[p - 1] + want[p - 1];
+        asked_displs[p] = num_send;
+        num_send += asked[p];
+    }
+    plan->num_send = num_send;
+    plan->send_index = (int *)malloc(num_send * sizeof(int) + 1);
+    plan->send_buf = (float *)malloc(num_send * sizeof(float) + 1);
+    MPI_Alltoallv(plan->ghost_cols, want, want_displs, MPI_INT, plan->send_index, asked, asked_displs, MPI_INT, comm);
+    for (int k = 0; k < num_send; k++)
+        plan->send_index[k] -= cstart;
+
+    // Keep only the ranks we actually exchange with.
+    plan->num_sources = plan->num_dests = 0;
+    for (int p = 0; p < size; p++)
+    {
+        plan->num_sources += want[p] > 0;
+        plan->num_dests += asked[p] > 0;
+    }
+    plan->sources = (int *)malloc(plan->num_sources * sizeof(int) + 1);
+    plan->recv_counts = (int *)malloc(plan->num_sources * sizeof(int) + 1);
+    plan->recv_displs = (int *)malloc(plan->num_sources * sizeof(int) + 1);
+    plan->dests = (int *)malloc(plan->num_dests * sizeof(int) + 1);
+    plan->send_counts = (int *)malloc(plan->num_dests * sizeof(int) + 1);
+    plan->send_displs = (int *)malloc(plan->num_dests * sizeof(int) + 1);
+    for (int p = 0, s = 0, d = 0; p < size; p++)
+    {
+        if (want[p] > 0)
+        {
+            plan->sources[s] = p;
+            plan->recv_counts[s] = want[p];
+            plan->recv_displs[s++] = want_displs[p];
+        }
+        if (asked[p] > 0)
+        {
+            plan->dests[d] = p;
+            plan->send_counts[d] = asked[p];
+            plan->send_displs[d++] = asked_displs[p];
+        }
+    }
+    plan->requests = (MPI_Request *)malloc((plan->num_sources + plan->num_dests) * sizeof(MPI_Request) + 1);
+    // Edges are weighted by the entries they carry.
+    MPI_Dist_graph_create_adjacent(comm, plan->num_sources, plan->sources, plan->recv_counts, plan->num_dests,
+                                   plan->dests, plan->send_counts, MPI_INFO_NULL, 0, &plan->graph);
+
+    free(want);
+    free(asked);
+    free(want_displs);
+    free(asked_displs);
+}
+
+// Build the plan for A (this rank's rows, global column indices) and write
+// A's columns relabelled for the local x into local_cols: owned columns
+// become 0 .. num_owned - 1, ghosts num_owned + their ghost slot.
+void halo_setup(const coo_matrix *A, const int *col_offsets, MPI_Comm comm, halo_plan *plan, int *local_cols)
+{
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    int cstart = col_offsets[rank], cend = col_offsets[rank + 1];
+
+    // Distinct remote columns, ascending.
+    int n = 0;
+    int *ghosts = (int *)malloc(A->num_nonzeros * sizeof(int) + 1);
+    for (int k = 0; k < A->num_nonzeros; k++)
+        if (A->cols[k] < cstart || A->cols[k] >= cend)
+            ghosts[n++] = A->cols[k];
+    int num_ghosts = sort_unique_ints(ghosts, n);
+    halo_setup_ghosts((int *)realloc(ghosts, num_ghosts * sizeof(int) + 1), num_ghosts, col_offsets, comm, plan);
+
+    for (int k = 0; k < A->num_nonzeros; k++)
+    {
+        int j = A->cols[k];
+        if (j >= cstart && j < cend)
+            local_cols[k] = j - cstart;
+        else
+            local_cols[k] = plan->num_owned +
+                            (int)((int *)bsearch(&j, plan->ghost_cols, num_ghosts, sizeof(int), cmp_halo_ints) -
+                                  plan->ghost_cols);
+    }
+}
+
+// Fill the ghost part of x (x[num_owned ..]) from the owners.
+void halo_exchange(halo_plan *plan, float *x)
+{
+    for (int k = 0; k < plan->num_send; k++)
+        plan->send_buf[k] = x[plan->send_index[k]];
+    MPI_Neighbor_alltoallv(plan->send_buf, plan->send_counts, plan->send_displs, MPI_FLOAT, x + plan->num_owned,
+                           plan->recv_counts, plan->recv_displs, MPI_FLOAT, plan->graph);
+}
+
+// Post the receives of the ghost part of x and the sends of our packed
+// entries on the graph communicator. x[num_owned ..] must not be touched
+// until halo_end.
+void halo_begin(halo_plan *plan, float *x)
+{
+    for (int s = 0; s < plan->num_sources; s++)
+        MPI_Irecv(x + plan->num_owned + plan->recv_displs[s], plan->recv_counts[s], MPI_FLOAT, plan->sources[s], 0,
+                  plan->graph, &plan->requests[s]);
+    for (int k = 0; k < plan->num_send; k++)
+        plan->send_buf[k] = x[plan->send_index[k]];
+    for (int d = 0; d < plan->num_dests; d++)
+        MPI_Isend(plan->send_buf + plan->send_displs[d], plan->send_counts[d], MPI_FLOAT, plan->dests[d], 0,
+                  plan->graph, &plan->requests[plan->num_sources + d]);
+}
+
+// Let the library advance the exchange; most MPI implementations only move
+// large (rendezvous) messages inside MPI calls.
+void halo_progress(halo_plan *plan)
+{
+    int done;
+    MPI_Testall(plan->num_sources + plan->num_dests, plan->requests, &done, MPI_STATUSES_IGNORE);
+}
+
+void halo_end(halo_plan *plan)
+{
+    MPI_Waitall(plan->num_sources + plan->num_dests, plan->requests, MPI_STATUSES_IGNORE);
+}
+
+// Split A (halo-layout columns) into the nonzeros that read owned x entries
+// and those that read ghosts. The interior can be multiplied between
+// halo_begin and halo_end; both parts keep A's rows and add into the same y.
+void halo_split(const coo_matrix *A, const halo_plan *plan, coo_matrix *interior, coo_matrix *boundary)
+{
+    int num_interior = 0;
+    for (int k = 0; k < A->num_nonzeros; k++)
+        num_interior += A->cols[k] < plan->num_owned;
+    coo_matrix *parts[2] = {interior, boundary};
+    int counts[2] = {num_interior, A->num_nonzeros - num_interior};
+    for (int p = 0; p < 2; p++)
+    {
+        parts[p]->num_rows = A->num_rows;
+        parts[p]->num_cols = A->num_cols;
+        parts[p]->num_nonzeros = 0;
+        parts[p]->rows = (int *)malloc(counts[p] * sizeof(int) + 1);
+        parts[p]->cols = (int *)malloc(counts[p] * sizeof(int) + 1);
+        parts[p]->vals = (float *)malloc(counts[p] * sizeof(float) + 1);
+    }
+    for (int k = 0; k < A->num_nonzeros; k++)
+    {
+        coo_matrix *part = parts[A->cols[k] >= plan->num_owned];
+        part->rows[part->num_nonzeros] = A->rows[k];
+        part->cols[part->num_nonzeros] = A->cols[k];
+        part->vals[part->num_nonzeros++] = A->vals[k];
+    }
+}
+
+// Create the exchange's requests for x once: a single
+// MPI_Neighbor_alltoallv_init with MPI-4, otherwise one MPI_Recv_init per
+// source and one MPI_Send_init per destination. Each exchange then packs,
+// starts and completes them without any per-message set-up.
+void halo_persistent_init(halo_plan *plan, float *x, halo_persistent *hp)
+{
+    hp->plan = plan;
+    hp->x = x;
+#if MPI_VERSION >= 4
+    hp->num_requests = 1;
+    hp->requests = (MPI_Request *)malloc(sizeof(MPI_Request));
+    MPI_Neighbor_alltoallv_init(plan->send_buf, plan->send_counts, plan->send_displs, MPI_FLOAT, x + plan->num_owned,
+                                plan->recv_counts, plan->recv_displs, MPI_FLOAT, plan->graph, MPI_INFO_NULL,
+                                hp->requests);
+#else
+    hp->num_requests = plan->num_sources + plan->num_dests;
+    hp->requests = (MPI_Request *)malloc(hp->num_requests * sizeof(MPI_Request) + 1);
+    for (int s = 0; s < plan->num_sources; s++)
+        MPI_Recv_init(x + plan->num_owned + plan->recv_displs[s], plan->recv_counts[s], MPI_FLOAT, plan->sources[s],
+                      0, plan->graph, &hp->requests[s]);
+    for (int d = 0; d < plan->num_dests; d++)
+        MPI_Send_init(plan->send_buf + plan->send_displs[d], plan->send_counts[d], MPI_FLOAT, plan->dests[d], 0,
+                      plan->graph, &hp->requests[plan->num_sources + d]);
+#endif
+}
+
+void halo_persistent_exchange(halo_persistent *hp)
+{
+    halo_plan *plan = hp->plan;
+    for (int k = 0; k < plan->num_send; k++)
+        plan->send_buf[k] = hp->x[plan->send_index[k]];
+    MPI_Startall(hp->num_requests, hp->requests);
+    MPI_Waitall(hp->num_requests, hp->requests, MPI_STATUSES_IGNORE);
+}
+
+void halo_persistent_free(halo_persistent *hp)
+{
+    for (int r = 0; r < hp->num_requests; r++)
+        MPI_Request_free(&hp->requests[r]);
+    free(hp->requests);
+}
+
+void halo_free(halo_plan *plan)
+{
+    MPI_Comm_free(&plan->graph);
+    free(plan->ghost_cols);
+    free(plan->sources);
+    free(plan->recv_counts);
+    free(plan->recv_displs);
+    free(plan->dests);
+    free(plan->send_counts);
+    free(plan->send_displs);
+    free(plan->send_index);
+    free(plan->send_buf);
+    free(plan->requests);
+}
+
+// Neighbours and ghost entries per rank, against what broadcasting all of
+// x would move, printed on rank 0.
+void halo_report(const halo_plan *plan, int num_cols, MPI_Comm comm)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    int mine[2] = {plan->num_sources, plan->num_ghosts}, most[2];
+    long long ghosts = plan->num_ghosts, total_ghosts;
+    MPI_Reduce(mine, most, 2, MPI_INT, MPI_MAX, 0, comm);
+    MPI_Reduce(&ghosts, &total_ghosts, 1, MPI_LONG_LONG, MPI_SUM, 0, comm);
+    if (rank == 0)
+        printf("Halo plan: up to %d neighbours, ghost x entries max %d avg %.1f per rank "
+               "(full broadcast: %d per rank)\n",
+               most[0], most[1], (double)total_ghosts / size, num_cols);
+}
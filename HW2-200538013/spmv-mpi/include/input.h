@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include "formats.h"
 #include "mmio.h"
 #include "../config.h"
@@ -68,6 +70,48 @@ void sort_coo(coo_matrix *coo)
 }
 
 
+// Binary COO file written by matgen: this header, then rows[nnz] and
+// cols[nnz] as 0-based int32 and vals[nnz] as float, sorted by row.
+#define COO_BINARY_MAGIC "SPMVCOO1"
+
+typedef struct coo_binary_header
+{
+    char magic[8];
+    long long num_rows, num_cols, num_nonzeros;
+} coo_binary_header;
+
+// Read coo from fid if it holds a binary COO file. Returns 0 (with fid
+// rewound) when the file is something else.
+static int read_coo_binary(coo_matrix *coo, FILE *fid, const char * filename)
+{
+    coo_binary_header header;
+    if (fread(&header, sizeof(header), 1, fid) != 1 || memcmp(header.magic, COO_BINARY_MAGIC, 8) != 0){
+        rewind(fid);
+        return 0;
+    }
+
+    if (header.num_rows > INT_MAX || header.num_cols > INT_MAX || header.num_nonzeros > INT_MAX){
+        printf("Matrix in %s is too large (%lld nonzeros) for 32-bit indexing\n", filename, header.num_nonzeros);
+        exit(1);
+    }
+
+    coo->num_rows     = (int) header.num_rows;
+    coo->num_cols     = (int) header.num_cols;
+    coo->num_nonzeros = (int) header.num_nonzeros;
+
+    coo->rows = (int*)malloc(coo->num_nonzeros * sizeof(int));
+    coo->cols = (int*)malloc(coo->num_nonzeros * sizeof(int));
+    coo->vals = (float*)malloc(coo->num_nonzeros * sizeof(float));
+
+    if (fread(coo->rows, sizeof(int), coo->num_nonzeros, fid) != (size_t)coo->num_nonzeros ||
+        fread(coo->cols, sizeof(int), coo->num_nonzeros, fid) != (size_t)coo->num_nonzeros ||
+        fread(coo->vals, sizeof(float), coo->num_nonzeros, fid) != (size_t)coo->num_nonzeros){
+        printf("Truncated binary matrix file %s\n", filename);
+        exit(1);
+    }
+    return 1;
+}
+
 void read_coo_matrix(coo_matrix *coo, const char * mm_filename)
 {
     FILE * fid;
@@ -80,6 +124,11 @@ void read_coo_matrix(coo_matrix *coo, const char * mm_filename)
         exit(1);
     }
 
+    if (read_coo_binary(coo, fid, mm_filename)){
+        fclose(fid);
+        return;
+    }
+
     if (mm_read_banner(fid, &matcode) != 0){
         printf("Could not process Matrix Market banner.\n");
         exit(1);
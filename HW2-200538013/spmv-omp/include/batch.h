@@ -0,0 +1,132 @@
+#pragma once
+
+// A batch of small COO matrices stored back to back in one pooled allocation.
+// Matrix m owns nonzeros [nnz_offset[m], nnz_offset[m+1]), rows
+// [row_offset[m], row_offset[m+1]) of the pooled y and columns
+// [col_offset[m], col_offset[m+1]) of the pooled x. Row and column indices
+// stay local to their matrix.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "formats.h"
+#include "input.h"
+
+typedef struct coo_batch
+{
+    int num_matrices;
+    long long num_nonzeros, num_rows, num_cols;  //totals over the batch
+    long long * nnz_offset;  //num_matrices + 1 entries
+    long long * row_offset;
+    long long * col_offset;
+    char * pool;  //single allocation backing the offsets and the arrays below
+    int * rows;
+    int * cols;
+    float * vals;
+} coo_batch;
+
+void delete_coo_batch(coo_batch * batch){
+    free(batch->pool);
+}
+
+static int cmp_strings(const void * a, const void * b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// Collect matrix paths: every *.mtx in a directory (sorted by name), or one
+// path per line of a list file. Returns the number of paths.
+static int list_batch_files(const char * path, char *** files_out)
+{
+    int count = 0, capacity = 64;
+    char ** files = (char**)malloc(capacity * sizeof(char*));
+    struct stat st;
+
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)){
+        DIR * dir = opendir(path);
+        struct dirent * ent;
+        while (dir && (ent = readdir(dir)) != NULL){
+            size_t len = strlen(ent->d_name);
+            if (len < 4 || strcmp(ent->d_name + len - 4, ".mtx") != 0)
+                continue;
+            if (count == capacity)
+                files = (char**)realloc(files, (capacity *= 2) * sizeof(char*));
+            files[count] = (char*)malloc(strlen(path) + len + 2);
+            sprintf(files[count++], "%s/%s", path, ent->d_name);
+        }
+        if (dir)
+            closedir(dir);
+        qsort(files, count, sizeof(char*), cmp_strings);
+    } else {
+        FILE * fid = fopen(path, "r");
+        char line[4096];
+        if (fid == NULL){
+            printf("Unable to open batch list %s\n", path);
+            exit(1);
+        }
+        while (fgets(line, sizeof(line), fid)){
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0' || line[0] == '#')
+                continue;
+            if (count == capacity)
+                files = (char**)realloc(files, (capacity *= 2) * sizeof(char*));
+            files[count] = (char*)malloc(strlen(line) + 1);
+            strcpy(files[count++], line);
+        }
+        fclose(fid);
+    }
+
+    *files_out = files;
+    return count;
+}
+
+// Load every matrix named by path (a directory or a list file) into one pool.
+void read_coo_batch(coo_batch * batch, const char * path)
+{
+    char ** files;
+    int n = list_batch_files(path, &files);
+    if (n == 0){
+        printf("No matrices found in %s\n", path);
+        exit(1);
+    }
+
+    coo_matrix * mats = (coo_matrix*)malloc(n * sizeof(coo_matrix));
+    long long nnz = 0, rows = 0, cols = 0;
+    for (int m = 0; m < n; m++){
+        load_coo_matrix(&mats[m], files[m], 0);
+        nnz += mats[m].num_nonzeros;
+        rows += mats[m].num_rows;
+        cols += mats[m].num_cols;
+    }
+
+    size_t offsets_bytes = 3 * (size_t)(n + 1) * sizeof(long long);
+    size_t index_bytes = 2 * (size_t)nnz * sizeof(int);
+    batch->pool = (char*)malloc(offsets_bytes + index_bytes + (size_t)nnz * sizeof(float));
+    batch->nnz_offset = (long long*)batch->pool;
+    batch->row_offset = batch->nnz_offset + (n + 1);
+    batch->col_offset = batch->row_offset + (n + 1);
+    batch->rows = (int*)(batch->pool + offsets_bytes);
+    batch->cols = batch->rows + nnz;
+    batch->vals = (float*)(batch->pool + offsets_bytes + index_bytes);
+
+    batch->num_matrices = n;
+    batch->num_nonzeros = nnz;
+    batch->num_rows = rows;
+    batch->num_cols = cols;
+
+    batch->nnz_offset[0] = batch->row_offset[0] = batch->col_offset[0] = 0;
+    for (int m = 0; m < n; m++){
+        long long base = batch->nnz_offset[m];
+        memcpy(batch->rows + base, mats[m].rows, mats[m].num_nonzeros * sizeof(int));
+        memcpy(batch->cols + base, mats[m].cols, mats[m].num_nonzeros * sizeof(int));
+        memcpy(batch->vals + base, mats[m].vals, mats[m].num_nonzeros * sizeof(float));
+        batch->nnz_offset[m + 1] = base + mats[m].num_nonzeros;
+        batch->row_offset[m + 1] = batch->row_offset[m] + mats[m].num_rows;
+        batch->col_offset[m + 1] = batch->col_offset[m] + mats[m].num_cols;
+        delete_coo_matrix(&mats[m]);
+        free(files[m]);
+    }
+    free(mats);
+    free(files);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+// Cache size detection from sysfs, falling back to the config.h constant.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../config.h"
+
+// Size in bytes of the level-N data/unified cache of cpu0, or 0 if unknown.
+size_t read_cache_size(int level)
+{
+    char path[128], type[32];
+    for(int index = 0; index < 16; index++){
+        FILE * f;
+        int lvl;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+        if((f = fopen(path, "r")) == NULL)
+            break;
+        if(fscanf(f, "%d", &lvl) != 1)
+            lvl = -1;
+        fclose(f);
+        if(lvl != level)
+            continue;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+        if((f = fopen(path, "r")) == NULL)
+            continue;
+        if(fscanf(f, "%31s", type) != 1)
+            type[0] = '\0';
+        fclose(f);
+        if(strcmp(type, "Instruction") == 0)
+            continue;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+        if((f = fopen(path, "r")) == NULL)
+            continue;
+        size_t size = 0;
+        char unit = 0;
+        int got = fscanf(f, "%zu%c", &size, &unit);
+        fclose(f);
+        if(got < 1)
+            continue;
+        if(unit == 'K') size *= 1024;
+        if(unit == 'M') size *= 1024 * 1024;
+        return size;
+    }
+    return 0;
+}
+
+// Detected size of the requested cache level; L3CACHE_SIZE when sysfs has
+// nothing for that level.
+size_t detect_cache_size(int level)
+{
+    size_t size = read_cache_size(level);
+    return size ? size : (size_t)L3CACHE_SIZE;
+}
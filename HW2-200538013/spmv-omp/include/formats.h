@@ -1,5 +1,7 @@
 
 #pragma once
+#include <stdlib.h>
+#include <string.h>
 
 // COOrdinate matrix (aka IJV or Triplet format)
 typedef struct coo_matrix
@@ -10,6 +12,71 @@ typedef struct coo_matrix
     float * vals;  //nonzero values
 } coo_matrix;
 
+// Compressed Sparse Row matrix
+typedef struct csr_matrix
+{
+    int num_rows, num_cols, num_nonzeros;
+    int * row_ptr;  //row offsets (num_rows + 1 entries)
+    int * cols;  //column indices
+    float * vals;  //nonzero values
+} csr_matrix;
+
+// Compressed Sparse Column matrix (the CSR layout of the transpose)
+typedef struct csc_matrix
+{
+    int num_rows, num_cols, num_nonzeros;
+    int * col_ptr;  //column offsets (num_cols + 1 entries), NULL until built
+    int * rows;  //row indices
+    float * vals;  //nonzero values
+} csc_matrix;
+
+// Sparse vector as sorted (index, value) pairs
+typedef struct sparse_vector
+{
+    int length, num_nonzeros;
+    int * indices;  //positions of the nonzeros
+    float * vals;  //nonzero values
+} sparse_vector;
+
+// CSR cut into vertical panels of panel_width columns. Each panel keeps only
+// its non-empty rows, so a row touched by a panel costs one row_ids entry.
+typedef struct panel_csr_matrix
+{
+    int num_rows, num_cols, num_nonzeros;
+    int panel_width, num_panels;
+    int * panel_ptr;  //first stored row of each panel (num_panels + 1 entries)
+    int * row_ids;  //matrix row of each stored row
+    int * row_ptr;  //offsets of each stored row into cols/vals
+    int * cols;  //column indices
+    float * vals;  //nonzero values
+} panel_csr_matrix;
+
+// DIAgonal matrix: stored diagonal d holds A[i, i + offsets[d]] at
+// data[d * num_rows + i], zero where the diagonal has no entry or leaves
+// the matrix.
+typedef struct dia_matrix
+{
+    int num_rows, num_cols, num_nonzeros;
+    int num_diags;
+    int num_sparse_diags;  //diagonals less than DIA_MIN_OCCUPANCY full
+    int * offsets;  //column minus row of each stored diagonal, ascending
+    float * data;  //num_diags * num_rows values
+} dia_matrix;
+
+// CSR whose values are replaced by bits-wide indices into a table of at most
+// DICT_MAX_VALUES distinct values. Codes are packed 8 / bits to a byte,
+// lowest bits first.
+#define DICT_MAX_VALUES 256
+typedef struct dict_csr_matrix
+{
+    int num_rows, num_cols, num_nonzeros;
+    int bits;  //1, 2, 4 or 8, so no code straddles a byte
+    int num_values;
+    float table[DICT_MAX_VALUES];  //distinct values in first-seen order
+    int * row_ptr;  //row offsets (num_rows + 1 entries)
+    int * cols;  //column indices
+    unsigned char * codes;  //packed value indices
+} dict_csr_matrix;
 
 void delete_coo_matrix(coo_matrix* coo){
     free(coo->rows);   free(coo->cols);   free(coo->vals);
@@ -33,3 +100,290 @@ size_t bytes_per_coo_spmv(const coo_matrix * coo)
     return bytes;
 }
 
+
+void delete_csr_matrix(csr_matrix* csr){
+    free(csr->row_ptr);   free(csr->cols);   free(csr->vals);
+}
+
+// Build a CSR copy of a COO matrix. The COO entries must already be sorted
+// by row (read_coo_matrix does this).
+void coo_to_csr(const coo_matrix * coo, csr_matrix * csr)
+{
+    csr->num_rows     = coo->num_rows;
+    csr->num_cols     = coo->num_cols;
+    csr->num_nonzeros = coo->num_nonzeros;
+
+    csr->row_ptr = (int*)calloc(coo->num_rows + 1, sizeof(int));
+    csr->cols = (int*)malloc(coo->num_nonzeros * sizeof(int));
+    csr->vals = (float*)malloc(coo->num_nonzeros * sizeof(float));
+
+    for(int n = 0; n < coo->num_nonzeros; n++)
+        csr->row_ptr[coo->rows[n] + 1]++;
+    for(int i = 0; i < coo->num_rows; i++)
+        csr->row_ptr[i + 1] += csr->row_ptr[i];
+
+    for(int n = 0; n < coo->num_nonzeros; n++){
+        csr->cols[n] = coo->cols[n];
+        csr->vals[n] = coo->vals[n];
+    }
+}
+
+void delete_csc_matrix(csc_matrix* csc){
+    free(csc->col_ptr);   free(csc->rows);   free(csc->vals);
+    csc->col_ptr = NULL;  csc->rows = NULL;  csc->vals = NULL;
+}
+
+// Build a CSC copy of a COO matrix with a counting sort on the column index.
+// Row order inside each column follows the order of the COO entries.
+void coo_to_csc(const coo_matrix * coo, csc_matrix * csc)
+{
+    csc->num_rows     = coo->num_rows;
+    csc->num_cols     = coo->num_cols;
+    csc->num_nonzeros = coo->num_nonzeros;
+
+    csc->col_ptr = (int*)calloc(coo->num_cols + 1, sizeof(int));
+    csc->rows = (int*)malloc(coo->num_nonzeros * sizeof(int));
+    csc->vals = (float*)malloc(coo->num_nonzeros * sizeof(float));
+
+    for(int n = 0; n < coo->num_nonzeros; n++)
+        csc->col_ptr[coo->cols[n] + 1]++;
+    for(int j = 0; j < coo->num_cols; j++)
+        csc->col_ptr[j + 1] += csc->col_ptr[j];
+
+    int * next = (int*)malloc(coo->num_cols * sizeof(int));
+    for(int j = 0; j < coo->num_cols; j++)
+        next[j] = csc->col_ptr[j];
+    for(int n = 0; n < coo->num_nonzeros; n++){
+        int dst = next[coo->cols[n]]++;
+        csc->rows[dst] = coo->rows[n];
+        csc->vals[dst] = coo->vals[n];
+    }
+    free(next);
+}
+
+// Same as coo_to_csc, starting from CSR.
+void csr_to_csc(const csr_matrix * csr, csc_matrix * csc)
+{
+    csc->num_rows     = csr->num_rows;
+    csc->num_cols     = csr->num_cols;
+    csc->num_nonzeros = csr->num_nonzeros;
+
+    csc->col_ptr = (int*)calloc(csr->num_cols + 1, sizeof(int));
+    csc->rows = (int*)malloc(csr->num_nonzeros * sizeof(int));
+    csc->vals = (float*)malloc(csr->num_nonzeros * sizeof(float));
+
+    for(int n = 0; n < csr->num_nonzeros; n++)
+        csc->col_ptr[csr->cols[n] + 1]++;
+    for(int j = 0; j < csr->num_cols; j++)
+        csc->col_ptr[j + 1] += csc->col_ptr[j];
+
+    int * next = (int*)malloc(csr->num_cols * sizeof(int));
+    for(int j = 0; j < csr->num_cols; j++)
+        next[j] = csc->col_ptr[j];
+    for(int i = 0; i < csr->num_rows; i++){
+        for(int jj = csr->row_ptr[i]; jj < csr->row_ptr[i + 1]; jj++){
+            int dst = next[csr->cols[jj]]++;
+            csc->rows[dst] = i;
+            csc->vals[dst] = csr->vals[jj];
+        }
+    }
+    free(next);
+}
+
+void delete_panel_csr_matrix(panel_csr_matrix* pcsr){
+    free(pcsr->panel_ptr);   free(pcsr->row_ids);   free(pcsr->row_ptr);
+    free(pcsr->cols);   free(pcsr->vals);
+}
+
+// Split a CSR matrix into column panels. Nonzeros are bucketed by panel with
+// a stable counting sort, so inside a panel they stay in row order.
+void csr_to_panel_csr(const csr_matrix * csr, int panel_width, panel_csr_matrix * pcsr)
+{
+    int num_panels = (csr->num_cols + panel_width - 1) / panel_width;
+    if(num_panels < 1)
+        num_panels = 1;
+
+    pcsr->num_rows     = csr->num_rows;
+    pcsr->num_cols     = csr->num_cols;
+    pcsr->num_nonzeros = csr->num_nonzeros;
+    pcsr->panel_width  = panel_width;
+    pcsr->num_panels   = num_panels;
+
+    int * nnz_ptr = (int*)calloc(num_panels + 1, sizeof(int));
+    int * rows = (int*)malloc(csr->num_nonzeros * sizeof(int));
+    pcsr->cols = (int*)malloc(csr->num_nonzeros * sizeof(int));
+    pcsr->vals = (float*)malloc(csr->num_nonzeros * sizeof(float));
+
+    for(int n = 0; n < csr->num_nonzeros; n++)
+        nnz_ptr[csr->cols[n] / panel_width + 1]++;
+    for(int p = 0; p < num_panels; p++)
+        nnz_ptr[p + 1] += nnz_ptr[p];
+
+    int * next = (int*)malloc(num_panels * sizeof(int));
+    for(int p = 0; p < num_panels; p++)
+        next[p] = nnz_ptr[p];
+    for(int i = 0; i < csr->num_rows; i++){
+        for(int jj = csr->row_ptr[i]; jj < csr->row_ptr[i + 1]; jj++){
+            int dst = next[csr->cols[jj] / panel_width]++;
+            rows[dst] = i;
+            pcsr->cols[dst] = csr->cols[jj];
+            pcsr->vals[dst] = csr->vals[jj];
+        }
+    }
+    free(next);
+
+    // Count the distinct rows of every panel, then compress them.
+    int stored_rows = 0;
+    for(int p = 0; p < num_panels; p++)
+        for(int n = nnz_ptr[p]; n < nnz_ptr[p + 1]; n++)
+            if(n == nnz_ptr[p] || rows[n] != rows[n - 1])
+                stored_rows++;
+
+    pcsr->panel_ptr = (int*)malloc((num_panels + 1) * sizeof(int));
+    pcsr->row_ids = (int*)malloc(stored_rows * sizeof(int));
+    pcsr->row_ptr = (int*)malloc((stored_rows + 1) * sizeof(int));
+
+    int r = 0;
+    for(int p = 0; p < num_panels; p++){
+        pcsr->panel_ptr[p] = r;
+        for(int n = nnz_ptr[p]; n < nnz_ptr[p + 1]; n++){
+            if(n == nnz_ptr[p] || rows[n] != rows[n - 1]){
+                pcsr->row_ids[r] = rows[n];
+                pcsr->row_ptr[r] = n;
+                r++;
+            }
+        }
+    }
+    pcsr->panel_ptr[num_panels] = r;
+    pcsr->row_ptr[r] = csr->num_nonzeros;
+
+    free(rows);
+    free(nnz_ptr);
+}
+
+void delete_sparse_vector(sparse_vector* v){
+    free(v->indices);   free(v->vals);
+}
+
+// A diagonal with fewer than this fraction of its positions set is sparse;
+// DIA is rejected when more than DIA_MAX_SPARSE_FRACTION of them are.
+#define DIA_MIN_OCCUPANCY 0.5
+#define DIA_MAX_SPARSE_FRACTION 0.2
+
+void delete_dia_matrix(dia_matrix* dia){
+    free(dia->offsets);   free(dia->data);
+    dia->offsets = NULL;  dia->data = NULL;
+}
+
+// Build a DIA copy of a CSR matrix. Returns 0, with only the diagonal counts
+// filled in and nothing allocated, if too many of its diagonals are sparse.
+int csr_to_dia(const csr_matrix * csr, dia_matrix * dia)
+{
+    int rows = csr->num_rows, cols = csr->num_cols;
+    int span = rows + cols - 1;  //offsets -(rows - 1) .. cols - 1
+    int * slot = (int*)calloc(span, sizeof(int));
+
+    dia->num_rows     = rows;
+    dia->num_cols     = cols;
+    dia->num_nonzeros = csr->num_nonzeros;
+    dia->offsets = NULL;
+    dia->data = NULL;
+
+    for(int i = 0; i < rows; i++)
+        for(int jj = csr->row_ptr[i]; jj < csr->row_ptr[i + 1]; jj++)
+            slot[csr->cols[jj] - i + rows - 1]++;
+
+    dia->num_diags = 0;
+    dia->num_sparse_diags = 0;
+    for(int k = 0; k < span; k++){
+        if(slot[k] == 0)
+            continue;
+        int off = k - (rows - 1);
+        int length = (off < 0 ? (rows + off < cols ? rows + off : cols) : (cols - off < rows ? cols - off : rows));
+        dia->num_diags++;
+        if(slot[k] < DIA_MIN_OCCUPANCY * length)
+            dia->num_sparse_diags++;
+    }
+
+    if(dia->num_sparse_diags > DIA_MAX_SPARSE_FRACTION * dia->num_diags){
+        free(slot);
+        return 0;
+    }
+
+    // slot[k] becomes the stored index of diagonal k.
+    dia->offsets = (int*)malloc(dia->num_diags * sizeof(int));
+    dia->data = (float*)calloc((size_t)dia->num_diags * rows, sizeof(float));
+    for(int k = 0, d = 0; k < span; k++){
+        if(slot[k] == 0)
+            continue;
+        dia->offsets[d] = k - (rows - 1);
+        slot[k] = d++;
+    }
+    for(int i = 0; i < rows; i++)
+        for(int jj = csr->row_ptr[i]; jj < csr->row_ptr[i + 1]; jj++)
+            dia->data[(size_t)slot[csr->cols[jj] - i + rows - 1] * rows + i] += csr->vals[jj];
+
+    free(slot);
+    return 1;
+}
+
+void delete_dict_csr_matrix(dict_csr_matrix* dict){
+    free(dict->row_ptr);   free(dict->cols);   free(dict->codes);
+}
+
+// Slot for value v in a small open-addressing table keyed on the float's
+// bit pattern (so -0.0 and 0.0 stay distinct and NaNs are matched exactly).
+#define DICT_HASH_SLOTS 1024
+static int dict_hash_slot(const unsigned int * keys, const short * index, unsigned int v)
+{
+    unsigned int h = (v * 2654435761u) >> 22;
+    while(index[h] >= 0 && keys[h] != v)
+        h = (h + 1) & (DICT_HASH_SLOTS - 1);
+    return h;
+}
+
+// Build a value-dictionary copy of a CSR matrix. Returns 0, with nothing
+// allocated, if the matrix has more than DICT_MAX_VALUES distinct values.
+int csr_to_dict_csr(const csr_matrix * csr, dict_csr_matrix * dict)
+{
+    unsigned int keys[DICT_HASH_SLOTS];
+    short index[DICT_HASH_SLOTS];
+    for(int h = 0; h < DICT_HASH_SLOTS; h++)
+        index[h] = -1;
+
+    dict->num_values = 0;
+    for(int n = 0; n < csr->num_nonzeros; n++){
+        unsigned int v;
+        memcpy(&v, &csr->vals[n], sizeof(v));
+        int h = dict_hash_slot(keys, index, v);
+        if(index[h] >= 0)
+            continue;
+        if(dict->num_values == DICT_MAX_VALUES){
+            dict->num_values = DICT_MAX_VALUES + 1;
+            return 0;
+        }
+        keys[h] = v;
+        index[h] = dict->num_values;
+        dict->table[dict->num_values++] = csr->vals[n];
+    }
+
+    dict->bits = dict->num_values <= 2 ? 1 : dict->num_values <= 4 ? 2 : dict->num_values <= 16 ? 4 : 8;
+    dict->num_rows     = csr->num_rows;
+    dict->num_cols     = csr->num_cols;
+    dict->num_nonzeros = csr->num_nonzeros;
+
+    int per_byte = 8 / dict->bits;
+    dict->row_ptr = (int*)malloc((csr->num_rows + 1) * sizeof(int));
+    dict->cols = (int*)malloc(csr->num_nonzeros * sizeof(int));
+    dict->codes = (unsigned char*)calloc(csr->num_nonzeros / per_byte + 1, 1);
+    memcpy(dict->row_ptr, csr->row_ptr, (csr->num_rows + 1) * sizeof(int));
+    memcpy(dict->cols, csr->cols, csr->num_nonzeros * sizeof(int));
+
+    for(int n = 0; n < csr->num_nonzeros; n++){
+        unsigned int v;
+        memcpy(&v, &csr->vals[n], sizeof(v));
+        int code = index[dict_hash_slot(keys, index, v)];
+        dict->codes[n / per_byte] |= (unsigned char)(code << ((n % per_byte) * dict->bits));
+    }
+    return 1;
+}
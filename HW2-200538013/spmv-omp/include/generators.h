@@ -0,0 +1,290 @@
+#pragma once
+
+// Synthetic sparse matrices for scaling studies, generated row by row.
+//
+// Every generator answers two questions about a row: how many nonzeros it
+// has (matgen_row_nnz) and what they are (matgen_row, columns ascending).
+// Both depend only on the row index and the seed, so any thread can produce
+// any row and the output does not depend on the thread count. Row and column
+// indices are 32-bit; nonzero counts are 64-bit.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+typedef enum matgen_kind
+{
+    MATGEN_STENCIL5,   //2D 5-point
+    MATGEN_STENCIL9,   //2D 9-point
+    MATGEN_STENCIL7,   //3D 7-point
+    MATGEN_STENCIL27,  //3D 27-point
+    MATGEN_BANDED,
+    MATGEN_RANDOM,
+    MATGEN_FEM,        //dense block x block couplings between neighbouring grid nodes
+    MATGEN_NUM_KINDS
+} matgen_kind;
+
+static const char *matgen_names[MATGEN_NUM_KINDS] = {
+    "stencil5", "stencil9", "stencil7", "stencil27", "banded", "random", "fem"};
+
+typedef struct matgen
+{
+    matgen_kind kind;
+    int nx, ny, nz;  //grid size for stencils and fem (nz = 1 for 2D)
+    int block;  //fem: degrees of freedom per grid node
+    int lower, upper;  //banded: number of sub- and super-diagonals
+    long long num_rows, num_cols;
+    long long num_nonzeros;  //random: exact target; otherwise filled in by matgen_count
+    unsigned long long seed;
+} matgen;
+
+// splitmix64: a stateless hash good enough to seed per-row streams.
+static inline uint64_t matgen_hash(uint64_t z)
+{
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t matgen_next(uint64_t *state)
+{
+    return matgen_hash((*state)++);
+}
+
+// Value in [-1, 1) for entry (i, j): every random entry and the off-diagonal
+// banded and fem entries. Stencils keep their constant -1 off the diagonal.
+static inline float matgen_value(const matgen *g, long long i, long long j)
+{
+    uint64_t h = matgen_hash(g->seed ^ matgen_hash(((uint64_t)i << 32) ^ (uint64_t)j));
+    return (float)(1.0 - 2.0 * (h >> 11) * (1.0 / 9007199254740992.0));
+}
+
+// Neighbour offsets (dx, dy, dz) of the grid stencils, in column order.
+static int matgen_stencil_offsets(const matgen *g, int offsets[27][3])
+{
+    int n = 0;
+    for (int dz = -1; dz <= 1; dz++)
+        for (int dy = -1; dy <= 1; dy++)
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                int dist = abs(dx) + abs(dy) + abs(dz);
+                int keep;
+                switch (g->kind)
+                {
+                case MATGEN_STENCIL5:
+                    keep = dz == 0 && dist <= 1;
+                    break;
+                case MATGEN_STENCIL9:
+                    keep = dz == 0;
+                    break;
+                case MATGEN_STENCIL7:
+                    keep = dist <= 1;
+                    break;
+                case MATGEN_FEM:
+                    keep = g->nz > 1 || dz == 0;
+                    break;
+                default:
+                    keep = 1;
+                }
+                if (!keep)
+                    continue;
+                offsets[n][0] = dx;
+                offsets[n][1] = dy;
+                offsets[n][2] = dz;
+                n++;
+            }
+    return n;
+}
+
+// Grid nodes next to node (x, y, z), including itself, as node indices.
+static int matgen_grid_neighbours(const matgen *g, long long node, long long *nbrs)
+{
+    int offsets[27][3];
+    int n = matgen_stencil_offsets(g, offsets), count = 0;
+    long long x = node % g->nx, y = (node / g->nx) % g->ny, z = node / ((long long)g->nx * g->ny);
+    for (int k = 0; k < n; k++)
+    {
+        long long xx = x + offsets[k][0], yy = y + offsets[k][1], zz = z + offsets[k][2];
+        if (xx < 0 || xx >= g->nx || yy < 0 || yy >= g->ny || zz < 0 || zz >= g->nz)
+            continue;
+        nbrs[count++] = (zz * g->ny + yy) * g->nx + xx;
+    }
+    return count;
+}
+
+// Row i of a random matrix gets an equal share of the exact nonzero total:
+// the quotient, plus one for the rows the remainder is spread over. Only the
+// remainder (< num_rows) is scaled by i, so nothing overflows while
+// num_rows <= INT32_MAX.
+static inline long long matgen_random_row_nnz(const matgen *g, long long i)
+{
+    long long q = g->num_nonzeros / g->num_rows, r = g->num_nonzeros % g->num_rows;
+    return q + (r * (i + 1) / g->num_rows - r * i / g->num_rows);
+}
+
+static int cmp_matgen_cols(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+long long matgen_row_nnz(const matgen *g, long long i)
+{
+    long long nbrs[27];
+    switch (g->kind)
+    {
+    case MATGEN_BANDED:
+    {
+        long long lo = i - g->lower < 0 ? 0 : i - g->lower;
+        long long hi = i + g->upper >= g->num_cols ? g->num_cols - 1 : i + g->upper;
+        return hi >= lo ? hi - lo + 1 : 0;
+    }
+    case MATGEN_RANDOM:
+        return matgen_random_row_nnz(g, i);
+    case MATGEN_FEM:
+        return (long long)matgen_grid_neighbours(g, i / g->block, nbrs) * g->block;
+    default:
+        return matgen_grid_neighbours(g, i, nbrs);
+    }
+}
+
+// Write row i's columns (ascending) and values; returns the row's nonzeros.
+long long matgen_row(const matgen *g, long long i, int *cols, float *vals)
+{
+    long long nbrs[27], n = 0;
+    switch (g->kind)
+    {
+    case MATGEN_BANDED:
+    {
+        long long lo = i - g->lower < 0 ? 0 : i - g->lower;
+        long long hi = i + g->upper >= g->num_cols ? g->num_cols - 1 : i + g->upper;
+        for (long long j = lo; j <= hi; j++, n++)
+        {
+            cols[n] = (int)j;
+            vals[n] = (j == i) ? (float)(g->lower + g->upper + 1) : matgen_value(g, i, j);
+        }
+        return n;
+    }
+    case MATGEN_RANDOM:
+    {
+        // Floyd's sampling of k distinct columns, then sorted; dense rows
+        // fall back to a selection pass over all columns.
+        long long k = matgen_random_row_nnz(g, i);
+        uint64_t state = matgen_hash(g->seed ^ (uint64_t)i);
+        if (k > g->num_cols / 8)
+        {
+            long long needed = k;
+            for (long long j = 0; j < g->num_cols && needed > 0; j++)
+                if ((long long)(matgen_next(&state) % (uint64_t)(g->num_cols - j)) < needed)
+                    cols[n++] = (int)j, needed--;
+        }
+        else
+        {
+            for (long long j = g->num_cols - k; j < g->num_cols; j++)
+            {
+                int c = (int)(matgen_next(&state) % (uint64_t)(j + 1)), seen = 0;
+                for (long long m = 0; m < n && !seen; m++)
+                    seen = cols[m] == c;
+                cols[n++] = seen ? (int)j : c;
+            }
+            qsort(cols, n, sizeof(int), cmp_matgen_cols);
+        }
+        for (long long m = 0; m < n; m++)
+            vals[m] = matgen_value(g, i, cols[m]);
+        return n;
+    }
+    case MATGEN_FEM:
+    {
+        int count = matgen_grid_neighbours(g, i / g->block, nbrs);
+        for (int k = 0; k < count; k++)
+            for (int d = 0; d < g->block; d++, n++)
+            {
+                long long j = nbrs[k] * g->block + d;
+                cols[n] = (int)j;
+                vals[n] = (j == i) ? (float)(count * g->block) : matgen_value(g, i, j);
+            }
+        return n;
+    }
+    default:
+    {
+        // Laplacian-like: -1 off the diagonal, the neighbour count on it.
+        int count = matgen_grid_neighbours(g, i, nbrs);
+        for (int k = 0; k < count; k++, n++)
+        {
+            cols[n] = (int)nbrs[k];
+            vals[n] = (nbrs[k] == i) ? (float)(count - 1) : -1.0f;
+        }
+        return n;
+    }
+    }
+}
+
+// Largest number of nonzeros any row can have (sizes the row buffers).
+long long matgen_max_row_nnz(const matgen *g)
+{
+    switch (g->kind)
+    {
+    case MATGEN_BANDED:
+        return g->lower + g->upper + 1;
+    case MATGEN_RANDOM:
+        return (g->num_nonzeros + g->num_rows - 1) / g->num_rows;
+    case MATGEN_FEM:
+        return 27LL * g->block;
+    default:
+        return 27;
+    }
+}
+
+// Fill in the matrix shape from the kind and its parameters. Returns 0 and
+// prints why if the parameters are out of range.
+int matgen_setup(matgen *g)
+{
+    if (g->nx < 1 || g->ny < 1 || g->nz < 1 || g->block < 1)
+    {
+        printf("Grid sizes and block size must be positive\n");
+        return 0;
+    }
+
+    switch (g->kind)
+    {
+    case MATGEN_STENCIL5:
+    case MATGEN_STENCIL9:
+        g->nz = 1;
+        g->num_rows = (long long)g->nx * g->ny;
+        break;
+    case MATGEN_STENCIL7:
+    case MATGEN_STENCIL27:
+        g->num_rows = (long long)g->nx * g->ny * g->nz;
+        break;
+    case MATGEN_FEM:
+        g->num_rows = (long long)g->nx * g->ny * g->nz * g->block;
+        break;
+    case MATGEN_BANDED:
+    case MATGEN_RANDOM:
+        if (g->num_cols <= 0)
+            g->num_cols = g->num_rows;
+        break;
+    default:
+        return 0;
+    }
+    if (g->kind != MATGEN_BANDED && g->kind != MATGEN_RANDOM)
+        g->num_cols = g->num_rows;
+
+    if (g->num_rows < 1 || g->num_rows > INT32_MAX || g->num_cols < 1 || g->num_cols > INT32_MAX)
+    {
+        printf("Matrix must have between 1 and %d rows and columns\n", INT32_MAX);
+        return 0;
+    }
+    if (g->kind == MATGEN_BANDED && (g->lower < 0 || g->upper < 0))
+    {
+        printf("Bandwidths must not be negative\n");
+        return 0;
+    }
+    if (g->kind == MATGEN_RANDOM && (g->num_nonzeros < 0 || g->num_nonzeros > g->num_rows * g->num_cols))
+    {
+        printf("Random matrix needs 0 <= nonzeros <= rows * cols\n");
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+// Row-block schedulers for the row-parallel kernels: the three OpenMP loop
+// schedules plus a work-stealing scheduler over blocks of `chunk` rows.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <omp.h>
+
+// File the auto-tuner caches its choice in, one line per matrix/thread count.
+// It lives next to the binary unless a path is given, so runs from any
+// working directory share one tuning.
+#define SCHED_CACHE_FILE "spmv_schedule.cache"
+
+typedef enum sched_kind
+{
+    SCHED_STATIC,
+    SCHED_DYNAMIC,
+    SCHED_GUIDED,
+    SCHED_STEAL,
+    SCHED_NUM_KINDS
+} sched_kind;
+
+static const char *sched_names[SCHED_NUM_KINDS] = {"static", "dynamic", "guided", "steal"};
+
+typedef struct row_schedule
+{
+    sched_kind kind;
+    int chunk;  //rows per block; 0 = OpenMP default for the loop schedules
+} row_schedule;
+
+// Parse "kind" or "kind,chunk" (e.g. "dynamic,64"). Returns 0 on bad input.
+int parse_row_schedule(const char *text, row_schedule *s)
+{
+    for (int k = 0; k < SCHED_NUM_KINDS; k++)
+    {
+        size_t len = strlen(sched_names[k]);
+        if (strncmp(text, sched_names[k], len) != 0 || (text[len] != '\0' && text[len] != ','))
+            continue;
+        s->kind = (sched_kind)k;
+        s->chunk = (text[len] == ',') ? atoi(text + len + 1) : 0;
+        if (s->kind == SCHED_STEAL && s->chunk <= 0)
+            s->chunk = 64;
+        return 1;
+    }
+    return 0;
+}
+
+// Apply a loop schedule so `schedule(runtime)` loops pick it up.
+void set_runtime_schedule(const row_schedule *s)
+{
+    static const omp_sched_t kinds[] = {omp_sched_static, omp_sched_dynamic, omp_sched_guided};
+    omp_set_schedule(kinds[s->kind == SCHED_STEAL ? SCHED_DYNAMIC : s->kind], s->chunk);
+}
+
+// Work-stealing deques over block indices, one per thread. A deque is the
+// half-open range [lo, hi) packed into one 64-bit word, so the owner taking
+// from the front and a thief taking from the back both update it with a
+// single compare-and-swap.
+typedef struct steal_deques
+{
+    int nthreads;
+    uint64_t *range;  //(hi << 32) | lo for each thread
+} steal_deques;
+
+static uint64_t steal_pack(uint32_t lo, uint32_t hi)
+{
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Hand each thread an equal contiguous share of num_blocks blocks.
+void init_steal_deques(steal_deques *d, int nthreads, int num_blocks)
+{
+    d->nthreads = nthreads;
+    d->range = (uint64_t *)malloc(nthreads * sizeof(uint64_t));
+    for (int t = 0; t < nthreads; t++)
+    {
+        uint32_t lo = (uint32_t)((long long)num_blocks * t / nthreads);
+        uint32_t hi = (uint32_t)((long long)num_blocks * (t + 1) / nthreads);
+        d->range[t] = steal_pack(lo, hi);
+    }
+}
+
+void delete_steal_deques(steal_deques *d)
+{
+    free(d->range);
+}
+
+// Owner side: take the next block from the front. Returns -1 when empty.
+static int steal_pop_front(steal_deques *d, int t)
+{
+    uint64_t cur = __atomic_load_n(&d->range[t], __ATOMIC_ACQUIRE);
+    for (;;)
+    {
+        uint32_t lo = (uint32_t)cur, hi = (uint32_t)(cur >> 32);
+        if (lo >= hi)
+            return -1;
+        if (__atomic_compare_exchange_n(&d->range[t], &cur, steal_pack(lo + 1, hi), 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return (int)lo;
+    }
+}
+
+// Thief side: take the last block of victim v. Returns -1 when empty.
+static int steal_pop_back(steal_deques *d, int v)
+{
+    uint64_t cur = __atomic_load_n(&d->range[v], __ATOMIC_ACQUIRE);
+    for (;;)
+    {
+        uint32_t lo = (uint32_t)cur, hi = (uint32_t)(cur >> 32);
+        if (lo >= hi)
+            return -1;
+        if (__atomic_compare_exchange_n(&d->range[v], &cur, steal_pack(lo, hi - 1), 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return (int)(hi - 1);
+    }
+}
+
+// Next block for thread t: its own deque first, then one from the others,
+// visited round-robin. Returns -1 once every deque is empty.
+int steal_next_block(steal_deques *d, int t)
+{
+    int b = steal_pop_front(d, t);
+    for (int k = 1; b < 0 && k < d->nthreads; k++)
+        b = steal_pop_back(d, (t + k) % d->nthreads);
+    return b;
+}
+
+// SCHED_CACHE_FILE in the directory of the running binary (from
+// /proc/self/exe, else argv0); in the working directory if neither says.
+void default_schedule_cache(const char *argv0, char *path, size_t size)
+{
+    char exe[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (len > 0)
+        exe[len] = '\0';
+    else
+        snprintf(exe, sizeof(exe), "%s", argv0);
+    char *slash = strrchr(exe, '/');
+    if (slash == NULL)
+        snprintf(path, size, "%s", SCHED_CACHE_FILE);
+    else
+        snprintf(path, size, "%.*s/%s", (int)(slash - exe), exe, SCHED_CACHE_FILE);
+}
+
+// Look up a cached schedule for this matrix (keyed by its absolute path) in
+// the cache file. A line is "rows nnz threads kind chunk path", the path last
+// so it may contain spaces; lines that do not parse are skipped and the last
+// valid match wins. Returns 1 if found.
+int load_cached_schedule(const char *cache, const char *matrix, int num_rows, int num_nonzeros, int nthreads,
+                         row_schedule *s)
+{
+    FILE *fid = fopen(cache, "r");
+    if (fid == NULL)
+        return 0;
+
+    char line[PATH_MAX + 128], kind[32];
+    int rows, nnz, threads, chunk, path_start, found = 0;
+    while (fgets(line, sizeof(line), fid) != NULL)
+    {
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%d %d %d %31s %d %n", &rows, &nnz, &threads, kind, &chunk, &path_start) != 5)
+            continue;
+        if (strcmp(line + path_start, matrix) != 0 || rows != num_rows || nnz != num_nonzeros || threads != nthreads)
+            continue;
+        row_schedule cached;
+        if (!parse_row_schedule(kind, &cached))
+            continue;
+        cached.chunk = chunk;
+        *s = cached;
+        found = 1;
+    }
+    fclose(fid);
+    return found;
+}
+
+void save_cached_schedule(const char *cache, const char *matrix, int num_rows, int num_nonzeros, int nthreads,
+                          const row_schedule *s)
+{
+    FILE *fid = fopen(cache, "a");
+    if (fid == NULL)
+        return;
+    fprintf(fid, "%d %d %d %s %d %s\n", num_rows, num_nonzeros, nthreads, sched_names[s->kind], s->chunk, matrix);
+    fclose(fid);
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+// Matrix-free constant-coefficient stencils on structured grids: the
+// Dirichlet Laplacian with 2 * ndims on the diagonal and -1 for each
+// neighbour along every axis (the 3-, 5- and 7-point stencils in natural
+// x-fastest ordering).
+#include <stdlib.h>
+#include "formats.h"
+
+typedef struct stencil_grid
+{
+    int nx, ny, nz;
+    int ndims;  //axes with more than one point
+} stencil_grid;
+
+// Recognise a matrix whose sparsity is exactly the 3/5/7-point stencil on
+// some nx x ny x nz grid. The grid is guessed from the DIA offsets
+// (1, nx, nx * ny) and then checked row by row against the CSR pattern.
+int detect_stencil_grid(const csr_matrix *csr, const dia_matrix *dia, stencil_grid *grid)
+{
+    int n = csr->num_rows, d = dia->num_diags;
+    if (csr->num_cols != n || d % 2 == 0 || d > 7 || dia->offsets[d / 2] != 0)
+        return 0;
+    for (int k = 1; k <= d / 2; k++)
+        if (dia->offsets[d / 2 - k] != -dia->offsets[d / 2 + k])
+            return 0;
+
+    const int *pos = dia->offsets + d / 2 + 1;  //positive offsets, ascending
+    int axes = d / 2;
+    if (axes == 0 || pos[0] != 1)
+        return 0;
+    grid->nx = (axes > 1) ? pos[1] : n;
+    grid->ny = (axes > 2) ? pos[2] / pos[1] : n / grid->nx;
+    grid->nz = (axes > 2) ? n / pos[2] : 1;
+    if ((long long)grid->nx * grid->ny * grid->nz != n || (axes > 2 && pos[2] % pos[1] != 0))
+        return 0;
+    grid->ndims = (grid->nx > 1) + (grid->ny > 1) + (grid->nz > 1);
+    if (grid->ndims != axes)
+        return 0;
+
+    long long nxy = (long long)grid->nx * grid->ny;
+    for (int i = 0; i < n; i++)
+    {
+        int x = i % grid->nx, y = (i / grid->nx) % grid->ny, z = (int)(i / nxy);
+        // One bit per neighbour the grid says row i has.
+        int expected = 1 | (x > 0) << 1 | (x < grid->nx - 1) << 2 | (y > 0) << 3 | (y < grid->ny - 1) << 4 |
+                       (z > 0) << 5 | (z < grid->nz - 1) << 6;
+        int seen = 0;
+        for (int jj = csr->row_ptr[i]; jj < csr->row_ptr[i + 1]; jj++)
+        {
+            long long diff = (long long)csr->cols[jj] - i;
+            int bit = diff == 0 ? 1 : diff == -1 ? 2 : diff == 1 ? 4 : diff == -grid->nx ? 8 : diff == grid->nx ? 16
+                    : diff == -nxy ? 32 : diff == nxy ? 64 : 0;
+            if (bit == 0 || (seen & bit))
+                return 0;
+            seen |= bit;
+        }
+        if (seen != expected)
+            return 0;
+    }
+    return 1;
+}
+
+// y = L x for the grid Laplacian, without any matrix storage. Rows of the
+// grid are independent; within a row every term is a contiguous stream.
+void stencil_apply(const stencil_grid *g, const float *restrict x, float *restrict y)
+{
+    int nx = g->nx, ny = g->ny, nz = g->nz;
+    long nxy = (long)nx * ny;
+    float center = 2.0f * g->ndims;
+
+#pragma omp parallel for collapse(2) schedule(static)
+    for (int z = 0; z < nz; z++)
+        for (int j = 0; j < ny; j++)
+        {
+            long base = z * nxy + (long)j * nx;
+            const float *xr = x + base;
+            float *yr = y + base;
+
+            if (nx == 1)
+                yr[0] = center * xr[0];
+            else
+            {
+                yr[0] = center * xr[0] - xr[1];
+#pragma omp simd
+                for (int i = 1; i < nx - 1; i++)
+                    yr[i] = center * xr[i] - xr[i - 1] - xr[i + 1];
+                yr[nx - 1] = center * xr[nx - 1] - xr[nx - 2];
+            }
+
+            if (j > 0)
+            {
+#pragma omp simd
+                for (int i = 0; i < nx; i++)
+                    yr[i] -= xr[i - nx];
+            }
+            if (j < ny - 1)
+            {
+#pragma omp simd
+                for (int i = 0; i < nx; i++)
+                    yr[i] -= xr[i + nx];
+            }
+            if (z > 0)
+            {
+#pragma omp simd
+                for (int i = 0; i < nx; i++)
+                    yr[i] -= xr[i - nxy];
+            }
+            if (z < nz - 1)
+            {
+#pragma omp simd
+                for (int i = 0; i < nx; i++)
+                    yr[i] -= xr[i + nxy];
+            }
+        }
+}
@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <omp.h>
+#include "cmdline.h"
+#include "input.h"
+#include "timer.h"
+#include "generators.h"
+
+// Rows handed to a thread at a time; also the unit of the offset table.
+#define MATGEN_BLOCK_ROWS 65536
+// Entries a thread buffers before writing them out.
+#define MATGEN_BUFFER_NNZ (1 << 20)
+
+void usage(int argc, char **argv)
+{
+    printf("Usage: %s --type=<kind> --out=<file.mtx|file.bin> [options]\n", argv[0]);
+    printf("Kinds:\n");
+    printf("  stencil5, stencil9    2D grid, --nx=N [--ny=N]\n");
+    printf("  stencil7, stencil27   3D grid, --nx=N [--ny=N] [--nz=N]\n");
+    printf("  banded                --rows=N [--cols=N] --band=B (or --lower=B --upper=B)\n");
+    printf("  random                --rows=N [--cols=N] --nnz=K (or --density=D), exactly K nonzeros\n");
+    printf("  fem                   --nx=N [--ny=N] [--nz=N] --block=B, B x B blocks between neighbouring nodes\n");
+    printf("Options:\n");
+    printf("  --seed=S     Seed for values and random structure (default 13)\n");
+    printf("Files ending in .mtx are written as MatrixMarket, anything else as binary COO.\n");
+}
+
+static long long arg_ll(int argc, char **argv, const char *key, long long fallback)
+{
+    char *val = get_argval(argc, argv, key);
+    return val ? atoll(val) : fallback;
+}
+
+// Nonzeros before each block of rows (num_blocks + 1 entries).
+static long long *count_block_offsets(const matgen *g, long long num_blocks)
+{
+    long long *offset = (long long *)malloc((num_blocks + 1) * sizeof(long long));
+    offset[0] = 0;
+
+#pragma omp parallel for schedule(dynamic, 16)
+    for (long long b = 0; b < num_blocks; b++)
+    {
+        long long end = (b + 1) * MATGEN_BLOCK_ROWS < g->num_rows ? (b + 1) * MATGEN_BLOCK_ROWS : g->num_rows;
+        long long nnz = 0;
+        for (long long i = b * MATGEN_BLOCK_ROWS; i < end; i++)
+            nnz += matgen_row_nnz(g, i);
+        offset[b + 1] = nnz;
+    }
+
+    for (long long b = 0; b < num_blocks; b++)
+        offset[b + 1] += offset[b];
+    return offset;
+}
+
+static void pwrite_all(int fd, const void *buf, size_t bytes, off_t pos)
+{
+    const char *p = (const char *)buf;
+    while (bytes > 0)
+    {
+        ssize_t n = pwrite(fd, p, bytes, pos);
+        if (n <= 0)
+        {
+            perror("pwrite");
+            exit(1);
+        }
+        p += n;
+        bytes -= n;
+        pos += n;
+    }
+}
+
+// Binary COO: every block knows where its entries go, so threads write
+// their slices of the rows, cols and vals sections independently.
+static void write_binary(const matgen *g, const char *path, const long long *offset, long long num_blocks)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        printf("Unable to open file %s\n", path);
+        exit(1);
+    }
+
+    long long nnz = offset[num_blocks];
+    coo_binary_header header;
+    memcpy(header.magic, COO_BINARY_MAGIC, 8);
+    header.num_rows = g->num_rows;
+    header.num_cols = g->num_cols;
+    header.num_nonzeros = nnz;
+    pwrite_all(fd, &header, sizeof(header), 0);
+
+    off_t rows_pos = sizeof(header);
+    off_t cols_pos = rows_pos + (off_t)nnz * sizeof(int);
+    off_t vals_pos = cols_pos + (off_t)nnz * sizeof(int);
+    long long row_cap = matgen_max_row_nnz(g);
+    long long cap = row_cap > MATGEN_BUFFER_NNZ ? row_cap : MATGEN_BUFFER_NNZ;
+
+#pragma omp parallel
+    {
+        int *rows = (int *)malloc(cap * sizeof(int));
+        int *cols = (int *)malloc(cap * sizeof(int));
+        float *vals = (float *)malloc(cap * sizeof(float));
+
+#pragma omp for schedule(dynamic, 1)
+        for (long long b = 0; b < num_blocks; b++)
+        {
+            long long end = (b + 1) * MATGEN_BLOCK_ROWS < g->num_rows ? (b + 1) * MATGEN_BLOCK_ROWS : g->num_rows;
+            long long pos = offset[b], n = 0;
+            for (long long i = b * MATGEN_BLOCK_ROWS; i < end; i++)
+            {
+                if (n + row_cap > cap)
+                {
+                    pwrite_all(fd, rows, n * sizeof(int), rows_pos + (off_t)pos * sizeof(int));
+                    pwrite_all(fd, cols, n * sizeof(int), cols_pos + (off_t)pos * sizeof(int));
+                    pwrite_all(fd, vals, n * sizeof(float), vals_pos + (off_t)pos * sizeof(float));
+                    pos += n;
+                    n = 0;
+                }
+                long long k = matgen_row(g, i, cols + n, vals + n);
+                for (long long m = 0; m < k; m++)
+                    rows[n + m] = (int)i;
+                n += k;
+            }
+            pwrite_all(fd, rows, n * sizeof(int), rows_pos + (off_t)pos * sizeof(int));
+            pwrite_all(fd, cols, n * sizeof(int), cols_pos + (off_t)pos * sizeof(int));
+            pwrite_all(fd, vals, n * sizeof(float), vals_pos + (off_t)pos * sizeof(float));
+        }
+
+        free(rows);
+        free(cols);
+        free(vals);
+    }
+
+    close(fd);
+}
+
+// MatrixMarket: threads format blocks in parallel and append them in order.
+static void write_mtx(const matgen *g, const char *path, const long long *offset, long long num_blocks)
+{
+    FILE *fid = fopen(path, "w");
+    if (fid == NULL)
+    {
+        printf("Unable to open file %s\n", path);
+        exit(1);
+    }
+    fprintf(fid, "%%%%MatrixMarket matrix coordinate real general\n");
+    fprintf(fid, "%% generated by matgen: %s seed=%llu\n", matgen_names[g->kind], g->seed);
+    fprintf(fid, "%lld %lld %lld\n", g->num_rows, g->num_cols, offset[num_blocks]);
+
+    long long row_cap = matgen_max_row_nnz(g);
+
+#pragma omp parallel
+    {
+        int *cols = (int *)malloc(row_cap * sizeof(int));
+        float *vals = (float *)malloc(row_cap * sizeof(float));
+        size_t len = 0, cap = 1 << 20;
+        char *text = (char *)malloc(cap);
+
+#pragma omp for ordered schedule(dynamic, 1)
+        for (long long b = 0; b < num_blocks; b++)
+        {
+            long long end = (b + 1) * MATGEN_BLOCK_ROWS < g->num_rows ? (b + 1) * MATGEN_BLOCK_ROWS : g->num_rows;
+            len = 0;
+            for (long long i = b * MATGEN_BLOCK_ROWS; i < end; i++)
+            {
+                long long k = matgen_row(g, i, cols, vals);
+                for (long long m = 0; m < k; m++)
+                {
+                    if (len + 64 > cap)
+                        text = (char *)realloc(text, cap *= 2);
+                    len += sprintf(text + len, "%lld %d %.7g\n", i + 1, cols[m] + 1, vals[m]);
+                }
+            }
+#pragma omp ordered
+            fwrite(text, 1, len, fid);
+        }
+
+        free(cols);
+        free(vals);
+        free(text);
+    }
+
+    fclose(fid);
+}
+
+int main(int argc, char **argv)
+{
+    char *type = get_argval(argc, argv, "type");
+    char *out = get_argval(argc, argv, "out");
+    if (get_arg(argc, argv, "help") != NULL || type == NULL || out == NULL)
+    {
+        usage(argc, argv);
+        return type == NULL || out == NULL ? -1 : 0;
+    }
+
+    matgen g;
+    memset(&g, 0, sizeof(g));
+    g.kind = MATGEN_NUM_KINDS;
+    for (int k = 0; k < MATGEN_NUM_KINDS; k++)
+        if (strcmp(type, matgen_names[k]) == 0)
+            g.kind = (matgen_kind)k;
+    if (g.kind == MATGEN_NUM_KINDS)
+    {
+        printf("Unknown matrix type %s\n", type);
+        return -1;
+    }
+
+    g.nx = (int)arg_ll(argc, argv, "nx", 0);
+    g.ny = (int)arg_ll(argc, argv, "ny", g.nx);
+    g.nz = (int)arg_ll(argc, argv, "nz", (g.kind == MATGEN_FEM) ? 1 : g.nx);
+    g.block = (int)arg_ll(argc, argv, "block", 1);
+    g.lower = (int)arg_ll(argc, argv, "band", 0);
+    g.upper = g.lower;
+    g.lower = (int)arg_ll(argc, argv, "lower", g.lower);
+    g.upper = (int)arg_ll(argc, argv, "upper", g.upper);
+    g.num_rows = arg_ll(argc, argv, "rows", 0);
+    g.num_cols = arg_ll(argc, argv, "cols", 0);
+    g.seed = (unsigned long long)arg_ll(argc, argv, "seed", 13);
+    if (g.kind == MATGEN_BANDED || g.kind == MATGEN_RANDOM)
+        g.nx = g.ny = g.nz = 1;
+    if (!matgen_setup(&g))
+        return -1;
+
+    if (g.kind == MATGEN_RANDOM)
+    {
+        char *density = get_argval(argc, argv, "density");
+        g.num_nonzeros = density ? llround(atof(density) * (double)g.num_rows * (double)g.num_cols)
+                                 : arg_ll(argc, argv, "nnz", 0);
+        if (!matgen_setup(&g))
+            return -1;
+    }
+
+    size_t len = strlen(out);
+    int as_mtx = len >= 4 && strcmp(out + len - 4, ".mtx") == 0;
+
+    timer t;
+    timer_start(&t);
+    long long num_blocks = (g.num_rows + MATGEN_BLOCK_ROWS - 1) / MATGEN_BLOCK_ROWS;
+    long long *offset = count_block_offsets(&g, num_blocks);
+    g.num_nonzeros = offset[num_blocks];
+
+    printf("Generating %s: rows=%lld cols=%lld nonzeros=%lld (%d threads)\n", matgen_names[g.kind], g.num_rows,
+           g.num_cols, g.num_nonzeros, omp_get_max_threads());
+    fflush(stdout);
+
+    if (as_mtx)
+        write_mtx(&g, out, offset, num_blocks);
+    else
+        write_binary(&g, out, offset, num_blocks);
+
+    double sec = seconds_elapsed(&t);
+    printf("\twrote %s (%s) in %.2f s\n", out, as_mtx ? "MatrixMarket" : "binary COO", sec);
+    if (g.num_nonzeros > INT_MAX)
+        printf("\tnote: more than %d nonzeros; the spmv binaries index with 32-bit ints and cannot load it\n", INT_MAX);
+
+    free(offset);
+    return 0;
+}
@@ -1,11 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <omp.h>
 #include "cmdline.h"
 #include "input.h"
 #include "config.h"
 #include "timer.h"
 #include "formats.h"
+#include "cache_info.h"
+#include "perf_counters.h"
+#include "energy.h"
+#include "batch.h"
+#include "scheduler.h"
+#include "stencil.h"
 
 #define max(a, b) \
     ({ __typeof__ (a) _a = (a); \
@@ -18,28 +25,95 @@
  _a < _b ? _a : _b; })
 void usage(int argc, char **argv)
 {
-    printf("Usage: %s [my_matrix.mtx]\n", argv);
+    printf("Usage: %s [my_matrix.mtx] [options]\n", argv[0]);
+    printf("       %s --batch=<directory|list.txt> [--perf] [--energy]\n", argv[0]);
     printf("Note: my_matrix.mtx must be real-valued sparse matrix in the MatrixMarket file format.\n");
+    printf("      Binary COO files written by matgen (see ./matgen --help) are accepted as well.\n");
+    printf("Options:\n");
+    printf("  --fused      Compare fused SpMV+dot / SpMV+AXPBY kernels against the unfused sequence\n");
+    printf("  --transpose  Benchmark y = A^T x with thread-private scatter and with a lazily built CSC\n");
+    printf("  --blocked[=L2|L3]  Benchmark column-panel SpMV with panels sized to the detected cache (default L2)\n");
+    printf("  --prefetch[=d]     Benchmark x-gather prefetching at distance d (auto-tuned when d is omitted)\n");
+    printf("  --perf       Print hardware counters (cycles, IPC, cache/TLB/branch misses) for every timed region\n");
+    printf("  --energy     Print RAPL package/DRAM energy, average power and GFLOP/J for every timed region\n");
+    printf("  --batch=P    Run SpMV over every matrix in directory P (or listed in file P) in one parallel region\n");
+    printf("  --spmspv[=d] Benchmark sparse-matrix x sparse-vector at x density d (default: sweep 1e-4 .. 0.5)\n");
+    printf("  --dia        Benchmark DIA SpMV (and the matrix-free stencil for 3/5/7-point grids) if the diagonals are dense enough\n");
+    printf("  --dict       Benchmark value-dictionary CSR (1-8 bit value codes) on the matrix's own values\n");
+    printf("  --schedule[=kind[,chunk]]  Row scheduling: static|dynamic|guided|steal; auto-tuned and cached if omitted\n");
+    printf("  --schedule-cache=P  Auto-tuner cache file (default: %s next to this binary)\n", SCHED_CACHE_FILE);
 }
 
-double benchmark_coo_spmv(coo_matrix *coo, float *x, float *y)
+// Counters around the timed kernel regions, enabled with --perf.
+static perf_group region_counters;
+static int count_regions = 0;
+
+// Energy of the same regions, enabled with --energy.
+static energy_meter region_energy;
+static int measure_energy = 0;
+
+static void energy_region_begin(void)
 {
-    int num_nonzeros = coo->num_nonzeros;
+    if (!measure_energy)
+        return;
+    energy_reset(&region_energy);
+    energy_start(&region_energy);
+}
 
-    // Start the timer for one iteration.
-    timer t;
-    timer_start(&t);
+static void energy_region_end(const char *region, double nonzeros)
+{
+    if (!measure_energy)
+        return;
+    energy_stop(&region_energy);
+    energy_print(&region_energy, region, 2.0 * nonzeros);
+}
+
+static void region_begin(void)
+{
+    energy_region_begin();
+    if (!count_regions)
+        return;
+    perf_group_reset(&region_counters);
+    perf_group_start(&region_counters);
+}
+
+// nonzeros is the number of matrix nonzeros the region processed in total.
+static void region_end(const char *region, double nonzeros)
+{
+    if (count_regions)
+    {
+        perf_group_stop(&region_counters);
+        perf_group_print(&region_counters, region, nonzeros, "nnz");
+    }
+    energy_region_end(region, nonzeros);
+}
 
-// Perform one iteration of SpMV using OpenMP.
+// y += A x over COO nonzeros; rows can be shared between threads, hence the atomic.
+void coo_spmv(const coo_matrix *coo, const float *x, float *y)
+{
 #pragma omp parallel for
-    for (int i = 0; i < num_nonzeros; i++)
+    for (int i = 0; i < coo->num_nonzeros; i++)
     {
 #pragma omp atomic
         y[coo->rows[i]] += coo->vals[i] * x[coo->cols[i]];
     }
+}
+
+double benchmark_coo_spmv(coo_matrix *coo, float *x, float *y)
+{
+    int num_nonzeros = coo->num_nonzeros;
+
+    // Start the timer for one iteration.
+    timer t;
+    timer_start(&t);
+
+    // Perform one iteration of SpMV using OpenMP.
+    region_begin();
+    coo_spmv(coo, x, y);
 
     // Measure the elapsed time in s
     double sec = seconds_elapsed(&t);
+    region_end("COO-SpMV", num_nonzeros);
 
     // Convert seconds to ms
     double msec = sec * 1000.0;
@@ -53,6 +127,1319 @@ double benchmark_coo_spmv(coo_matrix *coo, float *x, float *y)
     return sec;
 }
 
+// y = A x, one row per iteration so no atomics are needed.
+void csr_spmv(const csr_matrix *csr, const float *x, float *y)
+{
+#pragma omp parallel for
+    for (int i = 0; i < csr->num_rows; i++)
+    {
+        float sum = 0;
+        for (int jj = csr->row_ptr[i]; jj < csr->row_ptr[i + 1]; jj++)
+            sum += csr->vals[jj] * x[csr->cols[jj]];
+        y[i] = sum;
+    }
+}
+
+double dot(int n, const float *a, const float *b)
+{
+    double d = 0;
+#pragma omp parallel for reduction(+ : d)
+    for (int i = 0; i < n; i++)
+        d += a[i] * b[i];
+    return d;
+}
+
+// out = alpha * a + beta * b (out may alias a or b).
+void axpby(int n, float alpha, const float *a, float beta, const float *b, float *out)
+{
+#pragma omp parallel for
+    for (int i = 0; i < n; i++)
+        out[i] = alpha * a[i] + beta * b[i];
+}
+
+// y = A x and return dot(w, y) in the same sweep over the rows.
+double csr_spmv_dot(const csr_matrix *csr, const float *x, float *y, const float *w)
+{
+    double d = 0;
+#pragma omp parallel for reduction(+ : d)
+    for (int i = 0; i < csr->num_rows; i++)
+    {
+        float sum = 0;
+        for (int jj = csr->row_ptr[i]; jj < csr->row_ptr[i + 1]; jj++)
+            sum += csr->vals[jj] * x[csr->cols[jj]];
+        y[i] = sum;
+        d += w[i] * sum;
+    }
+    return d;
+}
+
+// y = alpha * A x + beta * z in the same sweep over the rows.
+void csr_spmv_axpby(const csr_matrix *csr, float alpha, const float *x, float beta, const float *z, float *y)
+{
+#pragma omp parallel for
+    for (int i = 0; i < csr->num_rows; i++)
+    {
+        float sum = 0;
+        for (int jj = csr->row_ptr[i]; jj < csr->row_ptr[i + 1]; jj++)
+            sum += csr->vals[jj] * x[csr->cols[jj]];
+        y[i] = alpha * sum + beta * z[i];
+    }
+}
+
+static int vectors_match(const float *a, const float *b, int n)
+{
+    for (int i = 0; i < n; i++)
+        if (fabsf(a[i] - b[i]) > 1e-4f * (1.0f + fabsf(b[i])))
+            return 0;
+    return 1;
+}
+
+static void print_fused_result(const char *name, double unfused_sec, double fused_sec, double flops, int correct)
+{
+    printf("\t%-12s unfused: %8.4f ms ( %5.2f GFLOP/s)  fused: %8.4f ms ( %5.2f GFLOP/s)  speedup: %5.2fx %s\n",
+           name,
+           unfused_sec * 1000.0, (unfused_sec == 0) ? 0 : flops / unfused_sec / 1e9,
+           fused_sec * 1000.0, (fused_sec == 0) ? 0 : flops / fused_sec / 1e9,
+           (fused_sec == 0) ? 0 : unfused_sec / fused_sec,
+           correct ? "" : "(MISMATCH)");
+}
+
+// Compare the fused Krylov building blocks against SpMV followed by a
+// separate vector sweep. Times are per iteration, averaged over MIN_ITER runs.
+void benchmark_fused_spmv(const csr_matrix *csr, const float *x, const float *w, const float *z)
+{
+    int n = csr->num_rows;
+    float alpha = 0.5f, beta = -2.0f;
+    float *y_ref = (float *)malloc(n * sizeof(float));
+    float *y = (float *)malloc(n * sizeof(float));
+    volatile double sink = 0;
+    timer t;
+
+    printf("\tfused kernels (%d iterations):\n", MIN_ITER);
+
+    // SpMV + dot
+    region_begin();
+    timer_start(&t);
+    for (int it = 0; it < MIN_ITER; it++)
+    {
+        csr_spmv(csr, x, y_ref);
+        sink += dot(n, w, y_ref);
+    }
+    double unfused = seconds_elapsed(&t) / MIN_ITER;
+    region_end("SpMV then dot", (double)csr->num_nonzeros * MIN_ITER);
+    double d_ref = dot(n, w, y_ref);
+
+    region_begin();
+    timer_start(&t);
+    for (int it = 0; it < MIN_ITER; it++)
+        sink += csr_spmv_dot(csr, x, y, w);
+    double fused = seconds_elapsed(&t) / MIN_ITER;
+    region_end("fused SpMV+dot", (double)csr->num_nonzeros * MIN_ITER);
+    double d = csr_spmv_dot(csr, x, y, w);
+
+    print_fused_result("SpMV+dot", unfused, fused, 2.0 * csr->num_nonzeros + 2.0 * n,
+                       vectors_match(y, y_ref, n) && fabs(d - d_ref) <= 1e-3 * (1.0 + fabs(d_ref)));
+
+    // SpMV + AXPBY
+    region_begin();
+    timer_start(&t);
+    for (int it = 0; it < MIN_ITER; it++)
+    {
+        csr_spmv(csr, x, y_ref);
+        axpby(n, alpha, y_ref, beta, z, y_ref);
+    }
+    unfused = seconds_elapsed(&t) / MIN_ITER;
+    region_end("SpMV then AXPBY", (double)csr->num_nonzeros * MIN_ITER);
+
+    region_begin();
+    timer_start(&t);
+    for (int it = 0; it < MIN_ITER; it++)
+        csr_spmv_axpby(csr, alpha, x, beta, z, y);
+    fused = seconds_elapsed(&t) / MIN_ITER;
+    region_end("fused SpMV+AXPBY", (double)csr->num_nonzeros * MIN_ITER);
+
+    print_fused_result("SpMV+AXPBY", unfused, fused, 2.0 * csr->num_nonzeros + 3.0 * n,
+                       vectors_match(y, y_ref, n));
+
+    free(y_ref);
+    free(y);
+}
+
+// Sum nthreads private copies of y (laid out one after another) into y.
+static void reduce_private_y(const float *y_private, int nthreads, int n, float *y)
+{
+#pragma omp parallel for
+    for (int j = 0; j < n; j++)
+    {
+        float sum = 0;
+        for (int t = 0; t < nthreads; t++)
+            sum += y_private[(size_t)t * n + j];
+        y[j] = sum;
+    }
+}
+
+// y = A^T x: every thread scatters its rows into a private copy of y, then the
+// copies are summed. Extra memory is nthreads * num_cols floats per call.
+void csr_spmv_t_scatter(const csr_matrix *csr, const float *x, float *y)
+{
+    int n = csr->num_cols;
+    int nthreads = omp_get_max_threads();
+    float *y_private = (float *)malloc((size_t)nthreads * n * sizeof(float));
+
+#pragma omp parallel num_threads(nthreads)
+    {
+        float *yt = y_private + (size_t)omp_get_thread_num() * n;
+        for (int j = 0; j < n; j++)
+            yt[j] = 0;
+
+#pragma omp for
+        for (int i = 0; i < csr->num_rows; i++)
+        {
+            float xi = x[i];
+            for (int jj = csr->row_ptr[i]; jj < csr->row_ptr[i + 1]; jj++)
+                yt[csr->cols[jj]] += csr->vals[jj] * xi;
+        }
+    }
+
+    reduce_private_y(y_private, nthreads, n, y);
+    free(y_private);
+}
+
+void coo_spmv_t_scatter(const coo_matrix *coo, const float *x, float *y)
+{
+    int n = coo->num_cols;
+    int nthreads = omp_get_max_threads();
+    float *y_private = (float *)malloc((size_t)nthreads * n * sizeof(float));
+
+#pragma omp parallel num_threads(nthreads)
+    {
+        float *yt = y_private + (size_t)omp_get_thread_num() * n;
+        for (int j = 0; j < n; j++)
+            yt[j] = 0;
+
+#pragma omp for
+        for (int i = 0; i < coo->num_nonzeros; i++)
+            yt[coo->cols[i]] += coo->vals[i] * x[coo->rows[i]];
+    }
+
+    reduce_private_y(y_private, nthreads, n, y);
+    free(y_private);
+}
+
+// y = A^T x as a row-parallel product over the CSC view, which is the CSR of A^T.
+void csc_spmv_t(const csc_matrix *csc, const float *x, float *y)
+{
+#pragma omp parallel for
+    for (int j = 0; j < csc->num_cols; j++)
+    {
+        float sum = 0;
+        for (int ii = csc->col_ptr[j]; ii < csc->col_ptr[j + 1]; ii++)
+            sum += csc->vals[ii] * x[csc->rows[ii]];
+        y[j] = sum;
+    }
+}
+
+// The CSC cache is built on first use and kept for later calls. A zeroed
+// csc_matrix (col_ptr == NULL) means "not built yet".
+void csr_spmv_t_cached(const csr_matrix *csr, csc_matrix *csc, const float *x, float *y)
+{
+    if (csc->col_ptr == NULL)
+        csr_to_csc(csr, csc);
+    csc_spmv_t(csc, x, y);
+}
+
+void coo_spmv_t_cached(const coo_matrix *coo, csc_matrix *csc, const float *x, float *y)
+{
+    if (csc->col_ptr == NULL)
+        coo_to_csc(coo, csc);
+    csc_spmv_t(csc, x, y);
+}
+
+static void print_transpose_result(const char *name, double build_sec, double sec, size_t extra_bytes,
+                                   int num_nonzeros, int correct)
+{
+    printf("\t%-16s build: %8.4f ms  per iteration: %8.4f ms ( %5.2f GFLOP/s)  extra memory: %8.2f MB %s\n",
+           name, build_sec * 1000.0, sec * 1000.0,
+           (sec == 0) ? 0 : 2.0 * num_nonzeros / sec / 1e9,
+           extra_bytes / (1024.0 * 1024.0), correct ? "" : "(MISMATCH)");
+}
+
+// Time both A^T x strategies on COO and CSR input. Per-iteration times are
+// averaged over MIN_ITER runs; the CSC build cost is the first call minus one
+// steady-state iteration.
+void benchmark_transpose_spmv(const coo_matrix *coo, const csr_matrix *csr, const float *x)
+{
+    int n = coo->num_cols;
+    int nthreads = omp_get_max_threads();
+    float *y_ref = (float *)calloc(n, sizeof(float));
+    float *y = (float *)malloc(n * sizeof(float));
+    size_t scatter_bytes = (size_t)nthreads * n * sizeof(float);
+    size_t csc_bytes = (size_t)(n + 1) * sizeof(int) + (size_t)coo->num_nonzeros * (sizeof(int) + sizeof(float));
+    timer t;
+
+    for (int i = 0; i < coo->num_nonzeros; i++)
+        y_ref[coo->cols[i]] += coo->vals[i] * x[coo->rows[i]];
+
+    printf("\ttranspose SpMV y = A^T x (%d iterations, %d threads):\n", MIN_ITER, nthreads);
+
+    region_begin();
+    timer_start(&t);
+    for (int it = 0; it < MIN_ITER; it++)
+        coo_spmv_t_scatter(coo, x, y);
+    print_transpose_result("COO scatter", 0, seconds_elapsed(&t) / MIN_ITER, scatter_bytes,
+                           coo->num_nonzeros, vectors_match(y, y_ref, n));
+    region_end("COO scatter A^T x", (double)coo->num_nonzeros * MIN_ITER);
+
+    region_begin();
+    timer_start(&t);
+    for (int it = 0; it < MIN_ITER; it++)
+        csr_spmv_t_scatter(csr, x, y);
+    print_transpose_result("CSR scatter", 0, seconds_elapsed(&t) / MIN_ITER, scatter_bytes,
+                           coo->num_nonzeros, vectors_match(y, y_ref, n));
+    region_end("CSR scatter A^T x", (double)coo->num_nonzeros * MIN_ITER);
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        csc_matrix csc = {0};
+        timer_start(&t);
+        if (pass == 0)
+            coo_spmv_t_cached(coo, &csc, x, y);
+        else
+            csr_spmv_t_cached(csr, &csc, x, y);
+        double first = seconds_elapsed(&t);
+
+        region_begin();
+        timer_start(&t);
+        for (int it = 0; it < MIN_ITER; it++)
+        {
+            if (pass == 0)
+                coo_spmv_t_cached(coo, &csc, x, y);
+            else
+                csr_spmv_t_cached(csr, &csc, x, y);
+        }
+        double sec = seconds_elapsed(&t) / MIN_ITER;
+
+        print_transpose_result(pass == 0 ? "COO cached CSC" : "CSR cached CSC", max(first - sec, 0.0), sec,
+                               csc_bytes, coo->num_nonzeros, vectors_match(y, y_ref, n));
+        region_end(pass == 0 ? "COO cached CSC A^T x" : "CSR cached CSC A^T x", (double)coo->num_nonzeros * MIN_ITER);
+        delete_csc_matrix(&csc);
+    }
+
+    free(y_ref);
+    free(y);
+}
+
+// y = A x one column panel at a time: the x entries of a panel stay in cache
+// while its rows are processed, and every panel adds its partial sums into y.
+void panel_csr_spmv(const panel_csr_matrix *pcsr, const float *x, float *y)
+{
+#pragma omp parallel
+    {
+#pragma omp for
+        for (int i = 0; i < pcsr->num_rows; i++)
+            y[i] = 0;
+
+        for (int p = 0; p < pcsr->num_panels; p++)
+        {
+            // Rows are unique within a panel; the barrier at the end of the
+            // loop keeps two panels from updating the same y[i] at once.
+#pragma omp for
+            for (int r = pcsr->panel_ptr[p]; r < pcsr->panel_ptr[p + 1]; r++)
+            {
+                float sum = 0;
+                for (int jj = pcsr->row_ptr[r]; jj < pcsr->row_ptr[r + 1]; jj++)
+                    sum += pcsr->vals[jj] * x[pcsr->cols[jj]];
+                y[pcsr->row_ids[r]] += sum;
+            }
+        }
+    }
+}
+
+static void print_miss_count(const char *name, long long count)
+{
+    if (count >= 0)
+        printf("  %s: %12lld", name, count / MIN_ITER);
+    else
+        printf("  %s: %12s", name, "n/a");
+}
+
+// Time one kernel over MIN_ITER iterations with the counter group around it,
+// printing per-iteration time and L1D/LLC misses.
+#define BENCHMARK_WITH_MISSES(label, nnz, call)                                         \
+    do                                                                                  \
+    {                                                                                   \
+        timer t_;                                                                       \
+        energy_region_begin();                                                          \
+        perf_group_reset(&counters);                                                    \
+        perf_group_start(&counters);                                                    \
+        timer_start(&t_);                                                               \
+        for (int it_ = 0; it_ < MIN_ITER; it_++)                                        \
+            call;                                                                       \
+        double sec_ = seconds_elapsed(&t_) / MIN_ITER;                                  \
+        perf_group_stop(&counters);                                                     \
+        printf("\t%-10s %8.4f ms ( %5.2f GFLOP/s)", label, sec_ * 1000.0,              \
+               (sec_ == 0) ? 0 : 2.0 * (nnz) / sec_ / 1e9);                             \
+        print_miss_count("L1D misses", counters.counts[PERF_L1D_MISSES]);               \
+        print_miss_count("LLC misses", counters.counts[PERF_LLC_MISSES]);               \
+        printf("\n");                                                                   \
+        if (count_regions)                                                              \
+            perf_group_print(&counters, label, (double)(nnz) * MIN_ITER, "nnz");        \
+        energy_region_end(label, (double)(nnz) * MIN_ITER);                             \
+    } while (0)
+
+// Compare plain CSR SpMV with the column-panel kernel. The matrix and y
+// streams are the same in both, so the change in misses comes from the x gather.
+void benchmark_blocked_spmv(const csr_matrix *csr, int cache_level, const float *x)
+{
+    size_t cache_bytes = detect_cache_size(cache_level);
+    // Give half of the cache to the x panel, the rest to A and y traffic.
+    int panel_width = (int)max(cache_bytes / 2 / sizeof(float), (size_t)1);
+
+    timer t;
+    panel_csr_matrix pcsr;
+    timer_start(&t);
+    csr_to_panel_csr(csr, panel_width, &pcsr);
+    double build = seconds_elapsed(&t);
+
+    printf("\tcolumn-blocked SpMV: L%d cache %zu bytes -> %d columns per panel, %d panels (build %.4f ms)\n",
+           cache_level, cache_bytes, panel_width, pcsr.num_panels, build * 1000.0);
+
+    perf_group counters;
+    if (!perf_group_open(&counters))
+        printf("\t(hardware cache counters unavailable; miss counts not reported)\n");
+
+    float *y_ref = (float *)malloc(csr->num_rows * sizeof(float));
+    float *y = (float *)malloc(csr->num_rows * sizeof(float));
+
+    BENCHMARK_WITH_MISSES("unblocked", csr->num_nonzeros, csr_spmv(csr, x, y_ref));
+    BENCHMARK_WITH_MISSES("blocked", csr->num_nonzeros, panel_csr_spmv(&pcsr, x, y));
+
+    if (!vectors_match(y, y_ref, csr->num_rows))
+        printf("\tblocked result does not match CSR SpMV\n");
+
+    perf_group_close(&counters);
+    delete_panel_csr_matrix(&pcsr);
+    free(y_ref);
+    free(y);
+}
+
+// Rows of y a thread finishes before moving on, so y stays in cache while
+// every diagonal streams past it.
+#define DIA_ROW_BLOCK 2048
+
+// DIA SpMV: each diagonal is a contiguous run of values against a shifted
+// contiguous run of x, so the inner loop has no index loads at all.
+void dia_spmv(const dia_matrix *dia, const float *restrict x, float *restrict y)
+{
+#pragma omp parallel for schedule(static)
+    for (int i0 = 0; i0 < dia->num_rows; i0 += DIA_ROW_BLOCK)
+    {
+        int i1 = min(i0 + DIA_ROW_BLOCK, dia->num_rows);
+        for (int i = i0; i < i1; i++)
+            y[i] = 0;
+        for (int d = 0; d < dia->num_diags; d++)
+        {
+            int off = dia->offsets[d];
+            int lo = max(i0, -off), hi = min(i1, dia->num_cols - off);
+            const float *restrict a = dia->data + (size_t)d * dia->num_rows;
+#pragma omp simd
+            for (int i = lo; i < hi; i++)
+                y[i] += a[i] * x[i + off];
+        }
+    }
+}
+
+// Compare CSR with DIA when the matrix is diagonal enough, and on 3/5/7-point
+// grids also with the matrix-free stencil (checked against a CSR holding the
+// same constant coefficients, since the loaded values are randomized).
+void benchmark_dia_spmv(const csr_matrix *csr, const float *x)
+{
+    dia_matrix dia;
+    timer t;
+    timer_start(&t);
+    int accepted = csr_to_dia(csr, &dia);
+    double build = seconds_elapsed(&t);
+
+    if (!accepted)
+    {
+        printf("\tDIA rejected: %d of %d diagonals are less than %.0f%% full; staying with CSR\n",
+               dia.num_sparse_diags, dia.num_diags, DIA_MIN_OCCUPANCY * 100);
+        return;
+    }
+    printf("\tDIA: %d diagonals (%d sparse), %.2f stored values per nonzero (build %.4f ms)\n", dia.num_diags,
+           dia.num_sparse_diags, (double)dia.num_diags * dia.num_rows / max(csr->num_nonzeros, 1), build * 1000.0);
+
+    perf_group counters;
+    if (!perf_group_open(&counters))
+        printf("\t(hardware cache counters unavailable; miss counts not reported)\n");
+
+    float *y_ref = (float *)malloc(csr->num_rows * sizeof(float));
+    float *y = (float *)malloc(csr->num_rows * sizeof(float));
+
+    BENCHMARK_WITH_MISSES("CSR", csr->num_nonzeros, csr_spmv(csr, x, y_ref));
+    BENCHMARK_WITH_MISSES("DIA", csr->num_nonzeros, dia_spmv(&dia, x, y));
+    if (!vectors_match(y, y_ref, csr->num_rows))
+        printf("\tDIA result does not match CSR SpMV\n");
+
+    stencil_grid grid;
+    if (detect_stencil_grid(csr, &dia, &grid))
+    {
+        printf("\tstructured %d x %d x %d grid, %d-point stencil:\n", grid.nx, grid.ny, grid.nz, 2 * grid.ndims + 1);
+
+        csr_matrix laplacian = *csr;
+        laplacian.vals = (float *)malloc(csr->num_nonzeros * sizeof(float));
+        for (int i = 0; i < csr->num_rows; i++)
+            for (int jj = csr->row_ptr[i]; jj < csr->row_ptr[i + 1]; jj++)
+                laplacian.vals[jj] = (csr->cols[jj] == i) ? 2.0f * grid.ndims : -1.0f;
+
+        BENCHMARK_WITH_MISSES("CSR", csr->num_nonzeros, csr_spmv(&laplacian, x, y_ref));
+        BENCHMARK_WITH_MISSES("stencil", csr->num_nonzeros, stencil_apply(&grid, x, y));
+        if (!vectors_match(y, y_ref, csr->num_rows))
+            printf("\tmatrix-free result does not match CSR SpMV\n");
+
+        free(laplacian.vals);
+    }
+
+    perf_group_close(&counters);
+    delete_dia_matrix(&dia);
+    free(y_ref);
+    free(y);
+}
+
+// CSR SpMV over dictionary codes. bits is a constant at each call site in
+// dict_csr_spmv, so unpacking a value is a shift, a mask and an L1 table load.
+static inline void dict_csr_spmv_bits(const dict_csr_matrix *dict, const float *x, float *y, const int bits)
+{
+    const unsigned int mask = (1u << bits) - 1;
+    const unsigned int per_byte = 8 / bits;
+    const float *table = dict->table;
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < dict->num_rows; i++)
+    {
+        float sum = 0;
+        for (unsigned int jj = dict->row_ptr[i]; jj < (unsigned int)dict->row_ptr[i + 1]; jj++)
+        {
+            unsigned int code = (dict->codes[jj / per_byte] >> ((jj % per_byte) * bits)) & mask;
+            sum += table[code] * x[dict->cols[jj]];
+        }
+        y[i] = sum;
+    }
+}
+
+void dict_csr_spmv(const dict_csr_matrix *dict, const float *x, float *y)
+{
+    switch (dict->bits)
+    {
+    case 1:
+        dict_csr_spmv_bits(dict, x, y, 1);
+        break;
+    case 2:
+        dict_csr_spmv_bits(dict, x, y, 2);
+        break;
+    case 4:
+        dict_csr_spmv_bits(dict, x, y, 4);
+        break;
+    default:
+        dict_csr_spmv_bits(dict, x, y, 8);
+    }
+}
+
+// Compare CSR with value-dictionary CSR on the values as loaded (the main
+// benchmarks randomize them, which would defeat the dictionary).
+void benchmark_dict_spmv(const csr_matrix *csr, const float *loaded_vals, const float *x)
+{
+    csr_matrix loaded = *csr;
+    loaded.vals = (float *)loaded_vals;
+
+    dict_csr_matrix dict;
+    if (!csr_to_dict_csr(&loaded, &dict))
+    {
+        printf("\tvalue dictionary rejected: more than %d distinct values; staying with CSR\n", DICT_MAX_VALUES);
+        return;
+    }
+    printf("\tvalue dictionary: %d distinct values -> %d-bit codes, values %.3f instead of %zu bytes per nonzero\n",
+           dict.num_values, dict.bits, dict.bits / 8.0, sizeof(float));
+
+    perf_group counters;
+    if (!perf_group_open(&counters))
+        printf("\t(hardware cache counters unavailable; miss counts not reported)\n");
+
+    float *y_ref = (float *)malloc(csr->num_rows * sizeof(float));
+    float *y = (float *)malloc(csr->num_rows * sizeof(float));
+
+    BENCHMARK_WITH_MISSES("CSR", csr->num_nonzeros, csr_spmv(&loaded, x, y_ref));
+    BENCHMARK_WITH_MISSES("dict CSR", csr->num_nonzeros, dict_csr_spmv(&dict, x, y));
+    if (!vectors_match(y, y_ref, csr->num_rows))
+        printf("\tdictionary result does not match CSR SpMV\n");
+
+    perf_group_close(&counters);
+    delete_dict_csr_matrix(&dict);
+    free(y_ref);
+    free(y);
+}
+
+// Prefetch distances tried by the auto-tuner; 0 means no prefetch.
+static const int prefetch_distances[] = {0, 4, 8, 16, 32, 64, 128, 256};
+#define NUM_PREFETCH_DISTANCES ((int)(sizeof(prefetch_distances) / sizeof(prefetch_distances[0])))
+
+// COO SpMV that prefetches x[cols[i + d]] while working on nonzero i. The
+// index is clamped to the last nonzero so the loop needs no tail.
+void coo_spmv_prefetch(const coo_matrix *coo, const float *x, float *y, int d)
+{
+    int last = coo->num_nonzeros - 1;
+#pragma omp parallel for
+    for (int i = 0; i < coo->num_nonzeros; i++)
+    {
+        __builtin_prefetch(&x[coo->cols[min(i + d, last)]], 0, 1);
+#pragma omp atomic
+        y[coo->rows[i]] += coo->vals[i] * x[coo->cols[i]];
+    }
+}
+
+// CSR SpMV with the same prefetch of x[cols[jj + d]], running ahead across
+// row boundaries.
+void csr_spmv_prefetch(const csr_matrix *csr, const float *x, float *y, int d)
+{
+    int last = csr->num_nonzeros - 1;
+#pragma omp parallel for
+    for (int i = 0; i < csr->num_rows; i++)
+    {
+        float sum = 0;
+        for (int jj = csr->row_ptr[i]; jj < csr->row_ptr[i + 1]; jj++)
+        {
+            __builtin_prefetch(&x[csr->cols[min(jj + d, last)]], 0, 1);
+            sum += csr->vals[jj] * x[csr->cols[jj]];
+        }
+        y[i] = sum;
+    }
+}
+
+// Average seconds per call of the COO (is_csr == 0) or CSR prefetch kernel at distance d.
+static double time_prefetch_kernel(const coo_matrix *coo, const csr_matrix *csr, int is_csr,
+                                   const float *x, float *y, int d, int iters)
+{
+    timer t;
+    timer_start(&t);
+    for (int it = 0; it < iters; it++)
+    {
+        if (is_csr)
+            d ? csr_spmv_prefetch(csr, x, y, d) : csr_spmv(csr, x, y);
+        else
+            d ? coo_spmv_prefetch(coo, x, y, d) : coo_spmv(coo, x, y);
+    }
+    return seconds_elapsed(&t) / iters;
+}
+
+// Sweep prefetch_distances on the loaded matrix and return the fastest one.
+int autotune_prefetch_distance(const coo_matrix *coo, const csr_matrix *csr, int is_csr,
+                               const float *x, float *y)
+{
+    int iters = max(MIN_ITER / 10, 1);
+    int best_d = 0;
+    double best_sec = 0;
+    for (int k = 0; k < NUM_PREFETCH_DISTANCES; k++)
+    {
+        double sec = time_prefetch_kernel(coo, csr, is_csr, x, y, prefetch_distances[k], iters);
+        if (k == 0 || sec < best_sec)
+        {
+            best_sec = sec;
+            best_d = prefetch_distances[k];
+        }
+    }
+    return best_d;
+}
+
+// Report the gain of the prefetching kernels over the plain ones for this
+// matrix. With d < 0 the distance is auto-tuned separately for COO and CSR.
+void benchmark_prefetch_spmv(const coo_matrix *coo, const csr_matrix *csr, const float *x, int d)
+{
+    float *y = (float *)malloc(coo->num_rows * sizeof(float));
+    float *y_ref = (float *)malloc(coo->num_rows * sizeof(float));
+
+    printf("\tprefetched SpMV (%d iterations):\n", MIN_ITER);
+    for (int is_csr = 0; is_csr < 2; is_csr++)
+    {
+        int dist = (d >= 0) ? d : autotune_prefetch_distance(coo, csr, is_csr, x, y);
+        region_begin();
+        double base = time_prefetch_kernel(coo, csr, is_csr, x, y, 0, MIN_ITER);
+        region_end(is_csr ? "CSR plain" : "COO plain", (double)coo->num_nonzeros * MIN_ITER);
+        region_begin();
+        double pf = time_prefetch_kernel(coo, csr, is_csr, x, y, dist, MIN_ITER);
+        region_end(is_csr ? "CSR prefetch" : "COO prefetch", (double)coo->num_nonzeros * MIN_ITER);
+
+        for (int i = 0; i < coo->num_rows; i++)
+            y[i] = y_ref[i] = 0;
+        if (is_csr)
+        {
+            csr_spmv(csr, x, y_ref);
+            csr_spmv_prefetch(csr, x, y, dist);
+        }
+        else
+        {
+            coo_spmv(coo, x, y_ref);
+            coo_spmv_prefetch(coo, x, y, dist);
+        }
+
+        printf("\t%s d=%-3d %s  plain: %8.4f ms  prefetch: %8.4f ms ( %5.2f GFLOP/s)  gain: %+6.1f%% %s\n",
+               is_csr ? "CSR" : "COO", dist, (d >= 0) ? "(fixed)" : "(tuned)",
+               base * 1000.0, pf * 1000.0, (pf == 0) ? 0 : 2.0 * coo->num_nonzeros / pf / 1e9,
+               (pf == 0) ? 0 : 100.0 * (base / pf - 1.0),
+               vectors_match(y, y_ref, coo->num_rows) ? "" : "(MISMATCH)");
+    }
+
+    free(y);
+    free(y_ref);
+}
+
+// Every SpMV of the batch inside one parallel region. A matrix belongs to a
+// single thread, so its rows are accumulated without atomics.
+void coo_batch_spmv(const coo_batch *batch, const float *x, float *y)
+{
+#pragma omp parallel for schedule(dynamic, 8)
+    for (int m = 0; m < batch->num_matrices; m++)
+    {
+        float *ym = y + batch->row_offset[m];
+        const float *xm = x + batch->col_offset[m];
+        for (long long r = 0; r < batch->row_offset[m + 1] - batch->row_offset[m]; r++)
+            ym[r] = 0;
+        for (long long k = batch->nnz_offset[m]; k < batch->nnz_offset[m + 1]; k++)
+            ym[batch->rows[k]] += batch->vals[k] * xm[batch->cols[k]];
+    }
+}
+
+// View matrix m of the batch as a coo_matrix (no copy).
+static coo_matrix coo_batch_matrix(const coo_batch *batch, int m)
+{
+    coo_matrix coo;
+    coo.num_rows = (int)(batch->row_offset[m + 1] - batch->row_offset[m]);
+    coo.num_cols = (int)(batch->col_offset[m + 1] - batch->col_offset[m]);
+    coo.num_nonzeros = (int)(batch->nnz_offset[m + 1] - batch->nnz_offset[m]);
+    coo.rows = batch->rows + batch->nnz_offset[m];
+    coo.cols = batch->cols + batch->nnz_offset[m];
+    coo.vals = batch->vals + batch->nnz_offset[m];
+    return coo;
+}
+
+// Compare one coo_spmv call (and fork/join) per matrix against the single
+// parallel region, reporting aggregate throughput over the whole batch.
+void benchmark_batched_spmv(const coo_batch *batch, const float *x)
+{
+    float *y_ref = (float *)malloc(batch->num_rows * sizeof(float));
+    float *y = (float *)malloc(batch->num_rows * sizeof(float));
+    double flops = 2.0 * batch->num_nonzeros;
+    timer t;
+
+    printf("\tbatched SpMV (%d iterations, %d threads):\n", MIN_ITER, omp_get_max_threads());
+
+    region_begin();
+    timer_start(&t);
+    for (int it = 0; it < MIN_ITER; it++)
+    {
+        for (int m = 0; m < batch->num_matrices; m++)
+        {
+            coo_matrix coo = coo_batch_matrix(batch, m);
+            float *ym = y_ref + batch->row_offset[m];
+            for (int r = 0; r < coo.num_rows; r++)
+                ym[r] = 0;
+            coo_spmv(&coo, x + batch->col_offset[m], ym);
+        }
+    }
+    double per_matrix = seconds_elapsed(&t) / MIN_ITER;
+    region_end("per-matrix COO-SpMV", (double)batch->num_nonzeros * MIN_ITER);
+
+    region_begin();
+    timer_start(&t);
+    for (int it = 0; it < MIN_ITER; it++)
+        coo_batch_spmv(batch, x, y);
+    double batched = seconds_elapsed(&t) / MIN_ITER;
+    region_end("batched SpMV", (double)batch->num_nonzeros * MIN_ITER);
+
+    printf("\tper-matrix calls: %8.4f ms ( %5.2f GFLOP/s, %10.0f matrices/s)\n",
+           per_matrix * 1000.0, (per_matrix == 0) ? 0 : flops / per_matrix / 1e9,
+           (per_matrix == 0) ? 0 : batch->num_matrices / per_matrix);
+    printf("\tsingle region:    %8.4f ms ( %5.2f GFLOP/s, %10.0f matrices/s)  speedup: %5.2fx %s\n",
+           batched * 1000.0, (batched == 0) ? 0 : flops / batched / 1e9,
+           (batched == 0) ? 0 : batch->num_matrices / batched,
+           (batched == 0) ? 0 : per_matrix / batched,
+           vectors_match(y, y_ref, (int)batch->num_rows) ? "" : "(MISMATCH)");
+
+    free(y_ref);
+    free(y);
+}
+
+// SpMSpV switches to the dense kernel once the nonzeros it would touch exceed
+// this fraction of nnz(A). The bucket passes cost several times more per
+// nonzero than streaming the matrix; on the example matrices the two meet
+// at around 10%.
+#define SPMSPV_DENSE_RATIO 0.05
+
+// Scratch space for csc_spmspv, sized once per matrix. acc is zero and seen
+// is 0 outside a call, so a call only pays for the rows it touches.
+typedef struct spmspv_workspace
+{
+    int num_buckets, bucket_rows;
+    float *acc;  //dense accumulator, one entry per row
+    char *seen;  //row already has an entry in its bucket's output
+    int *counts;  //per thread, per bucket entry counts
+    int *buf_rows;  //bucketed contributions
+    float *buf_vals;
+    int buf_capacity;
+    int *out_count;  //number of output rows per bucket
+    long long *work_prefix;  //matrix nonzeros in the columns of x's first k entries
+    int prefix_capacity;
+} spmspv_workspace;
+
+void init_spmspv_workspace(spmspv_workspace *ws, int num_rows)
+{
+    int nthreads = omp_get_max_threads();
+    ws->num_buckets = nthreads * 4;
+    ws->bucket_rows = max((num_rows + ws->num_buckets - 1) / ws->num_buckets, 1);
+    ws->acc = (float *)calloc(num_rows, sizeof(float));
+    ws->seen = (char *)calloc(num_rows, sizeof(char));
+    ws->counts = (int *)malloc((size_t)nthreads * ws->num_buckets * sizeof(int));
+    ws->out_count = (int *)malloc((ws->num_buckets + 1) * sizeof(int));
+    ws->buf_rows = NULL;
+    ws->buf_vals = NULL;
+    ws->buf_capacity = 0;
+    ws->work_prefix = NULL;
+    ws->prefix_capacity = 0;
+}
+
+void delete_spmspv_workspace(spmspv_workspace *ws)
+{
+    free(ws->acc);
+    free(ws->seen);
+    free(ws->counts);
+    free(ws->out_count);
+    free(ws->buf_rows);
+    free(ws->buf_vals);
+    free(ws->work_prefix);
+}
+
+static int cmp_ints(const void *a, const void *b)
+{
+    int ia = *(const int *)a, ib = *(const int *)b;
+    return (ia > ib) - (ia < ib);
+}
+
+// Number of matrix nonzeros an SpMSpV with this x would read, with its
+// prefix over x's entries kept in ws for csc_spmspv to split the threads on.
+long long spmspv_work(const csc_matrix *csc, const sparse_vector *x, spmspv_workspace *ws)
+{
+    if (x->num_nonzeros + 1 > ws->prefix_capacity)
+    {
+        ws->prefix_capacity = x->num_nonzeros + 1;
+        ws->work_prefix = (long long *)realloc(ws->work_prefix, ws->prefix_capacity * sizeof(long long));
+    }
+    long long work = 0;
+    for (int k = 0; k < x->num_nonzeros; k++)
+    {
+        ws->work_prefix[k] = work;
+        work += csc->col_ptr[x->indices[k] + 1] - csc->col_ptr[x->indices[k]];
+    }
+    ws->work_prefix[x->num_nonzeros] = work;
+    return work;
+}
+
+// Last entry k of x whose column's nonzeros start at or before position w of
+// the work (prefix[k] <= w); the thread owning w starts there.
+static int spmspv_first_entry(const long long *prefix, int n, long long w)
+{
+    int lo = 0, hi = n - 1;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (prefix[mid] <= w)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+// y = A x for sparse x, reading only the columns x->indices of the CSC view.
+// Threads split the nonzeros of those columns evenly, cutting inside a
+// column if needed, and drop every contribution into a row bucket; each
+// bucket is then merged by one thread through the dense accumulator and
+// emitted with its rows sorted. Rows that sum to zero are left out, as in
+// the dense kernel. spmspv_work must have been called for this x.
+// y->indices/vals must hold num_rows entries.
+void csc_spmspv(const csc_matrix *csc, const sparse_vector *x, sparse_vector *y, spmspv_workspace *ws)
+{
+    int nb = ws->num_buckets, br = ws->bucket_rows;
+    int nthreads = omp_get_max_threads();
+    const long long *prefix = ws->work_prefix;
+    long long work = prefix[x->num_nonzeros];
+
+    if (work > ws->buf_capacity)
+    {
+        ws->buf_capacity = (int)work;
+        ws->buf_rows = (int *)realloc(ws->buf_rows, work * sizeof(int));
+        ws->buf_vals = (float *)realloc(ws->buf_vals, work * sizeof(float));
+    }
+
+#pragma omp parallel num_threads(nthreads)
+    {
+        int t = omp_get_thread_num();
+        int *count = ws->counts + (size_t)t * nb;
+        long long wlo = work * t / nthreads, whi = work * (t + 1) / nthreads;
+        int first = spmspv_first_entry(prefix, x->num_nonzeros, wlo);
+
+        // 1. Count this thread's contributions per bucket.
+        for (int b = 0; b < nb; b++)
+            count[b] = 0;
+        for (int k = first; k < x->num_nonzeros && prefix[k] < whi; k++)
+        {
+            int j = x->indices[k];
+            int begin = csc->col_ptr[j] + (int)((wlo > prefix[k] ? wlo : prefix[k]) - prefix[k]);
+            int end = csc->col_ptr[j] + (int)((whi < prefix[k + 1] ? whi : prefix[k + 1]) - prefix[k]);
+            for (int ii = begin; ii < end; ii++)
+                count[csc->rows[ii] / br]++;
+        }
+
+#pragma omp barrier
+#pragma omp single
+        {
+            // Offsets ordered by bucket, then thread.
+            int offset = 0;
+            for (int b = 0; b < nb; b++)
+            {
+                ws->out_count[b] = offset;
+                for (int tt = 0; tt < nthreads; tt++)
+                {
+                    int c = ws->counts[(size_t)tt * nb + b];
+                    ws->counts[(size_t)tt * nb + b] = offset;
+                    offset += c;
+                }
+            }
+            ws->out_count[nb] = offset;
+        }
+
+        // 2. Scatter (row, a_ij * x_j) into the buckets.
+        for (int k = first; k < x->num_nonzeros && prefix[k] < whi; k++)
+        {
+            int j = x->indices[k];
+            float xj = x->vals[k];
+            int begin = csc->col_ptr[j] + (int)((wlo > prefix[k] ? wlo : prefix[k]) - prefix[k]);
+            int end = csc->col_ptr[j] + (int)((whi < prefix[k + 1] ? whi : prefix[k + 1]) - prefix[k]);
+            for (int ii = begin; ii < end; ii++)
+            {
+                int dst = count[csc->rows[ii] / br]++;
+                ws->buf_rows[dst] = csc->rows[ii];
+                ws->buf_vals[dst] = csc->vals[ii] * xj;
+            }
+        }
+
+#pragma omp barrier
+        // 3. Merge each bucket; its distinct rows with a nonzero sum are
+        // compacted in place at the front of the bucket's buffer segment.
+#pragma omp for schedule(dynamic)
+        for (int b = 0; b < nb; b++)
+        {
+            int begin = ws->out_count[b], end = ws->out_count[b + 1], nrows = 0;
+            for (int e = begin; e < end; e++)
+            {
+                int r = ws->buf_rows[e];
+                ws->acc[r] += ws->buf_vals[e];
+                if (!ws->seen[r])
+                {
+                    ws->seen[r] = 1;
+                    ws->buf_rows[begin + nrows++] = r;
+                }
+            }
+            int kept = 0;
+            for (int e = 0; e < nrows; e++)
+            {
+                int r = ws->buf_rows[begin + e];
+                if (ws->acc[r] != 0)
+                    ws->buf_rows[begin + kept++] = r;
+                else
+                {
+                    ws->acc[r] = 0;
+                    ws->seen[r] = 0;
+                }
+            }
+            nrows = kept;
+            qsort(ws->buf_rows + begin, nrows, sizeof(int), cmp_ints);
+            ws->counts[b] = nrows;  //reused: distinct rows of bucket b
+        }
+
+#pragma omp single
+        {
+            int offset = 0;
+            for (int b = 0; b < nb; b++)
+            {
+                int nrows = ws->counts[b];
+                ws->counts[b] = offset;
+                offset += nrows;
+            }
+            y->num_nonzeros = offset;
+        }
+
+        // 4. Emit the sorted rows and clear the accumulator behind them.
+#pragma omp for schedule(dynamic)
+        for (int b = 0; b < nb; b++)
+        {
+            int begin = ws->out_count[b];
+            int dst = ws->counts[b];
+            int nrows = ((b + 1 < nb) ? ws->counts[b + 1] : y->num_nonzeros) - dst;
+            for (int e = 0; e < nrows; e++)
+            {
+                int r = ws->buf_rows[begin + e];
+                y->indices[dst + e] = r;
+                y->vals[dst + e] = ws->acc[r];
+                ws->acc[r] = 0;
+                ws->seen[r] = 0;
+            }
+        }
+    }
+    y->length = csc->num_rows;
+}
+
+// Dense fallback: expand x, run the CSR kernel, and compress y to its
+// nonzero entries.
+void csr_spmspv_dense(const csr_matrix *csr, const sparse_vector *x, sparse_vector *y, float *x_dense, float *y_dense)
+{
+#pragma omp parallel for
+    for (int j = 0; j < csr->num_cols; j++)
+        x_dense[j] = 0;
+    for (int k = 0; k < x->num_nonzeros; k++)
+        x_dense[x->indices[k]] = x->vals[k];
+
+    csr_spmv(csr, x_dense, y_dense);
+
+    int nnz = 0;
+    for (int i = 0; i < csr->num_rows; i++)
+    {
+        if (y_dense[i] != 0)
+        {
+            y->indices[nnz] = i;
+            y->vals[nnz++] = y_dense[i];
+        }
+    }
+    y->num_nonzeros = nnz;
+    y->length = csr->num_rows;
+}
+
+// Pick the sparse or the dense kernel from the work x implies. Returns 1 if
+// the dense kernel ran.
+int spmspv(const csr_matrix *csr, const csc_matrix *csc, const sparse_vector *x, sparse_vector *y,
+           spmspv_workspace *ws, float *x_dense, float *y_dense)
+{
+    if (spmspv_work(csc, x, ws) > SPMSPV_DENSE_RATIO * csr->num_nonzeros)
+    {
+        csr_spmspv_dense(csr, x, y, x_dense, y_dense);
+        return 1;
+    }
+    csc_spmspv(csc, x, y, ws);
+    return 0;
+}
+
+// Random sparse x with exactly round(density * n) sorted nonzeros (at least one).
+static void random_sparse_vector(sparse_vector *x, int n, double density)
+{
+    int nnz = (int)(density * n + 0.5);
+    nnz = min(max(nnz, 1), n);
+    x->length = n;
+    x->num_nonzeros = 0;
+    x->indices = (int *)malloc(nnz * sizeof(int));
+    x->vals = (float *)malloc(nnz * sizeof(float));
+    // Selection sampling keeps the indices sorted.
+    for (int j = 0; j < n && x->num_nonzeros < nnz; j++)
+    {
+        if ((double)rand() / ((double)RAND_MAX + 1.0) * (n - j) < nnz - x->num_nonzeros)
+        {
+            x->indices[x->num_nonzeros] = j;
+            x->vals[x->num_nonzeros++] = rand() / (RAND_MAX + 1.0);
+        }
+    }
+}
+
+static int sparse_matches_dense(const sparse_vector *y, const float *y_dense, int n)
+{
+    float *expanded = (float *)calloc(n, sizeof(float));
+    for (int k = 0; k < y->num_nonzeros; k++)
+        expanded[y->indices[k]] = y->vals[k];
+    int ok = vectors_match(expanded, y_dense, n);
+    // Both kernels list exactly the nonzero rows.
+    int nnz = 0;
+    for (int i = 0; i < n; i++)
+        nnz += y_dense[i] != 0;
+    ok = ok && nnz == y->num_nonzeros;
+    free(expanded);
+    return ok;
+}
+
+// For each x density: the bucketed SpMSpV, the dense kernel on the expanded
+// x, and the switching wrapper, averaged over MIN_ITER runs.
+void benchmark_spmspv(const csr_matrix *csr, double density)
+{
+    static const double sweep[] = {1e-4, 1e-3, 1e-2, 1e-1, 0.5};
+    int num_densities = (density > 0) ? 1 : (int)(sizeof(sweep) / sizeof(sweep[0]));
+
+    csc_matrix csc;
+    csr_to_csc(csr, &csc);
+    spmspv_workspace ws;
+    init_spmspv_workspace(&ws, csr->num_rows);
+
+    sparse_vector y;
+    y.indices = (int *)malloc(csr->num_rows * sizeof(int));
+    y.vals = (float *)malloc(csr->num_rows * sizeof(float));
+    float *x_dense = (float *)malloc(csr->num_cols * sizeof(float));
+    float *y_dense = (float *)malloc(csr->num_rows * sizeof(float));
+    float *y_ref = (float *)malloc(csr->num_rows * sizeof(float));
+    timer t;
+
+    printf("\tSpMSpV (%d iterations, dense switch at %.0f%% of nnz(A)):\n", MIN_ITER, 100.0 * SPMSPV_DENSE_RATIO);
+    for (int d = 0; d < num_densities; d++)
+    {
+        sparse_vector x;
+        random_sparse_vector(&x, csr->num_cols, (density > 0) ? density : sweep[d]);
+        long long work = spmspv_work(&csc, &x, &ws);
+
+        csr_spmspv_dense(csr, &x, &y, x_dense, y_dense);
+        memcpy(y_ref, y_dense, csr->num_rows * sizeof(float));
+
+        region_begin();
+        timer_start(&t);
+        for (int it = 0; it < MIN_ITER; it++)
+            csc_spmspv(&csc, &x, &y, &ws);
+        double sparse_sec = seconds_elapsed(&t) / MIN_ITER;
+        region_end("bucketed SpMSpV", (double)work * MIN_ITER);
+        int sparse_ok = sparse_matches_dense(&y, y_ref, csr->num_rows);
+
+        region_begin();
+        timer_start(&t);
+        for (int it = 0; it < MIN_ITER; it++)
+            csr_spmspv_dense(csr, &x, &y, x_dense, y_dense);
+        double dense_sec = seconds_elapsed(&t) / MIN_ITER;
+        region_end("dense SpMV for SpMSpV", (double)csr->num_nonzeros * MIN_ITER);
+
+        int used_dense = 0;
+        timer_start(&t);
+        for (int it = 0; it < MIN_ITER; it++)
+            used_dense = spmspv(csr, &csc, &x, &y, &ws, x_dense, y_dense);
+        double auto_sec = seconds_elapsed(&t) / MIN_ITER;
+        int auto_ok = sparse_matches_dense(&y, y_ref, csr->num_rows);
+
+        printf("\tx nnz=%-8d (%.4f) work=%-10lld y nnz=%-8d bucketed: %8.4f ms  dense: %8.4f ms  auto(%s): %8.4f ms %s\n",
+               x.num_nonzeros, (double)x.num_nonzeros / csr->num_cols, work, y.num_nonzeros,
+               sparse_sec * 1000.0, dense_sec * 1000.0, used_dense ? "dense" : "sparse", auto_sec * 1000.0,
+               (sparse_ok && auto_ok) ? "" : "(MISMATCH)");
+        delete_sparse_vector(&x);
+    }
+
+    delete_sparse_vector(&y);
+    delete_spmspv_workspace(&ws);
+    delete_csc_matrix(&csc);
+    free(x_dense);
+    free(y_dense);
+    free(y_ref);
+}
+
+// y = A x with rows handed out by sched. When busy is not NULL, busy[t]
+// accumulates the seconds thread t spent on its rows (waiting excluded).
+void csr_spmv_scheduled(const csr_matrix *csr, const float *x, float *y, const row_schedule *sched, double *busy)
+{
+    int nthreads = omp_get_max_threads();
+    steal_deques deques;
+    if (sched->kind == SCHED_STEAL)
+        init_steal_deques(&deques, nthreads, (csr->num_rows + sched->chunk - 1) / sched->chunk);
+    else
+        set_runtime_schedule(sched);
+
+#pragma omp parallel num_threads(nthreads)
+    {
+        int t = omp_get_thread_num();
+        timer tt;
+        timer_start(&tt);
+
+        if (sched->kind == SCHED_STEAL)
+        {
+            int b;
+            while ((b = steal_next_block(&deques, t)) >= 0)
+            {
+                int end = min((b + 1) * sched->chunk, csr->num_rows);
+                for (int i = b * sched->chunk; i < end; i++)
+                {
+                    float sum = 0;
+                    for (int jj = csr->row_ptr[i]; jj < csr->row_ptr[i + 1]; jj++)
+                        sum += csr->vals[jj] * x[csr->cols[jj]];
+                    y[i] = sum;
+                }
+            }
+        }
+        else
+        {
+#pragma omp for schedule(runtime) nowait
+            for (int i = 0; i < csr->num_rows; i++)
+            {
+                float sum = 0;
+                for (int jj = csr->row_ptr[i]; jj < csr->row_ptr[i + 1]; jj++)
+                    sum += csr->vals[jj] * x[csr->cols[jj]];
+                y[i] = sum;
+            }
+        }
+
+        if (busy)
+            busy[t] += seconds_elapsed(&tt);
+    }
+
+    if (sched->kind == SCHED_STEAL)
+        delete_steal_deques(&deques);
+}
+
+// Schedules the auto-tuner tries.
+static const row_schedule sched_candidates[] = {
+    {SCHED_STATIC, 0}, {SCHED_DYNAMIC, 16}, {SCHED_DYNAMIC, 64}, {SCHED_DYNAMIC, 256},
+    {SCHED_GUIDED, 16}, {SCHED_GUIDED, 64}, {SCHED_STEAL, 64}, {SCHED_STEAL, 256}};
+#define NUM_SCHED_CANDIDATES ((int)(sizeof(sched_candidates) / sizeof(sched_candidates[0])))
+
+// Run sched for iters iterations; returns seconds per iteration and fills
+// busy[] with per-iteration busy seconds per thread.
+static double time_scheduled_spmv(const csr_matrix *csr, const float *x, float *y, const row_schedule *sched,
+                                  int iters, double *busy)
+{
+    int nthreads = omp_get_max_threads();
+    for (int t = 0; t < nthreads; t++)
+        busy[t] = 0;
+
+    timer t;
+    timer_start(&t);
+    for (int it = 0; it < iters; it++)
+        csr_spmv_scheduled(csr, x, y, sched, busy);
+    double sec = seconds_elapsed(&t) / iters;
+
+    for (int tt = 0; tt < nthreads; tt++)
+        busy[tt] /= iters;
+    return sec;
+}
+
+static void print_schedule_line(const row_schedule *sched, double sec, const double *busy, int nnz)
+{
+    int nthreads = omp_get_max_threads();
+    double lo = busy[0], hi = busy[0], sum = 0;
+    for (int t = 0; t < nthreads; t++)
+    {
+        lo = min(lo, busy[t]);
+        hi = max(hi, busy[t]);
+        sum += busy[t];
+    }
+    double avg = sum / nthreads;
+    printf("\t%-8s chunk=%-4d %8.4f ms ( %5.2f GFLOP/s)  busy min/avg/max: %.4f/%.4f/%.4f ms  imbalance: %.2f\n",
+           sched_names[sched->kind], sched->chunk, sec * 1000.0, (sec == 0) ? 0 : 2.0 * nnz / sec / 1e9,
+           lo * 1000.0, avg * 1000.0, hi * 1000.0, (avg == 0) ? 0 : hi / avg);
+}
+
+// Time every candidate on this matrix and return the fastest.
+row_schedule autotune_row_schedule(const csr_matrix *csr, const float *x, float *y, double *busy)
+{
+    int iters = max(MIN_ITER / 10, 1);
+    row_schedule best = sched_candidates[0];
+    double best_sec = 0;
+    for (int k = 0; k < NUM_SCHED_CANDIDATES; k++)
+    {
+        double sec = time_scheduled_spmv(csr, x, y, &sched_candidates[k], iters, busy);
+        print_schedule_line(&sched_candidates[k], sec, busy, csr->num_nonzeros);
+        if (k == 0 || sec < best_sec)
+        {
+            best_sec = sec;
+            best = sched_candidates[k];
+        }
+    }
+    return best;
+}
+
+// Pick a row schedule (forced, cached in the file cache, or tuned now and
+// cached) and show the per-thread busy time it gives, so load imbalance is
+// visible.
+void benchmark_scheduled_spmv(const csr_matrix *csr, const float *x, const char *matrix, const row_schedule *forced,
+                              const char *cache)
+{
+    // The same matrix reached through different relative paths shares an entry.
+    char matrix_path[PATH_MAX];
+    if (realpath(matrix, matrix_path) == NULL)
+        snprintf(matrix_path, sizeof(matrix_path), "%s", matrix);
+
+    int nthreads = omp_get_max_threads();
+    double *busy = (double *)malloc(nthreads * sizeof(double));
+    float *y = (float *)malloc(csr->num_rows * sizeof(float));
+    float *y_ref = (float *)malloc(csr->num_rows * sizeof(float));
+    row_schedule sched;
+
+    printf("\tscheduled CSR-SpMV (%d threads):\n", nthreads);
+    if (forced)
+    {
+        sched = *forced;
+        printf("\tusing requested schedule\n");
+    }
+    else if (load_cached_schedule(cache, matrix_path, csr->num_rows, csr->num_nonzeros, nthreads, &sched))
+    {
+        printf("\tusing cached schedule from %s\n", cache);
+    }
+    else
+    {
+        printf("\tauto-tuning (%d iterations per candidate):\n", max(MIN_ITER / 10, 1));
+        sched = autotune_row_schedule(csr, x, y, busy);
+        save_cached_schedule(cache, matrix_path, csr->num_rows, csr->num_nonzeros, nthreads, &sched);
+    }
+
+    region_begin();
+    double sec = time_scheduled_spmv(csr, x, y, &sched, MIN_ITER, busy);
+    region_end("scheduled CSR-SpMV", (double)csr->num_nonzeros * MIN_ITER);
+
+    csr_spmv(csr, x, y_ref);
+    printf("\tselected (%d iterations):\n", MIN_ITER);
+    print_schedule_line(&sched, sec, busy, csr->num_nonzeros);
+    for (int t = 0; t < nthreads; t++)
+        printf("\t  thread %3d busy %.4f ms\n", t, busy[t] * 1000.0);
+    if (!vectors_match(y, y_ref, csr->num_rows))
+        printf("\tscheduled result does not match CSR SpMV\n");
+
+    free(busy);
+    free(y);
+    free(y_ref);
+}
+
+// --batch mode: load the whole batch into one pool and benchmark it.
+int batch_main(int argc, char **argv, const char *batch_path)
+{
+    coo_batch batch;
+    printf("Reading matrix batch from %s\n", batch_path);
+    read_coo_batch(&batch, batch_path);
+
+    srand(13);
+    for (long long i = 0; i < batch.num_nonzeros; i++)
+        batch.vals[i] = 1.0 - 2.0 * (rand() / (RAND_MAX + 1.0));
+
+    printf("\nbatch=%s matrices=%d rows=%lld cols=%lld nonzeros=%lld\n", batch_path, batch.num_matrices,
+           batch.num_rows, batch.num_cols, batch.num_nonzeros);
+    fflush(stdout);
+
+    if (get_arg(argc, argv, "perf") != NULL)
+    {
+        count_regions = perf_group_open(&region_counters);
+        perf_group_report_unavailable(&region_counters);
+    }
+    if (get_arg(argc, argv, "energy") != NULL)
+    {
+        measure_energy = energy_open(&region_energy);
+        energy_report_unavailable(&region_energy);
+    }
+
+    float *x = (float *)malloc(batch.num_cols * sizeof(float));
+    for (long long i = 0; i < batch.num_cols; i++)
+        x[i] = rand() / (RAND_MAX + 1.0);
+
+    benchmark_batched_spmv(&batch, x);
+
+    if (count_regions)
+        perf_group_close(&region_counters);
+    delete_coo_batch(&batch);
+    free(x);
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     if (get_arg(argc, argv, "help") != NULL)
@@ -61,6 +1448,10 @@ int main(int argc, char **argv)
         return 0;
     }
 
+    char *batch_path = get_argval(argc, argv, "batch");
+    if (batch_path != NULL)
+        return batch_main(argc, argv, batch_path);
+
     char *mm_filename = NULL;
     if (argc == 1)
     {
@@ -76,6 +1467,14 @@ int main(int argc, char **argv)
     coo_matrix coo;
     read_coo_matrix(&coo, mm_filename);
 
+    // Keep the values as loaded for --dict before they are randomized.
+    float *loaded_vals = NULL;
+    if (get_arg(argc, argv, "dict") != NULL)
+    {
+        loaded_vals = (float *)malloc(coo.num_nonzeros * sizeof(float));
+        memcpy(loaded_vals, coo.vals, coo.num_nonzeros * sizeof(float));
+    }
+
     // Fill matrix with random values for testing.
     srand(13);
     for (int i = 0; i < coo.num_nonzeros; i++)
@@ -86,6 +1485,17 @@ int main(int argc, char **argv)
     printf("\nfile=%s rows=%d cols=%d nonzeros=%d\n", mm_filename, coo.num_rows, coo.num_cols, coo.num_nonzeros);
     fflush(stdout);
 
+    if (get_arg(argc, argv, "perf") != NULL)
+    {
+        count_regions = perf_group_open(&region_counters);
+        perf_group_report_unavailable(&region_counters);
+    }
+    if (get_arg(argc, argv, "energy") != NULL)
+    {
+        measure_energy = energy_open(&region_energy);
+        energy_report_unavailable(&region_energy);
+    }
+
     float *x = (float *)malloc(coo.num_cols * sizeof(float));
     float *y = (float *)malloc(coo.num_rows * sizeof(float));
 
@@ -98,6 +1508,89 @@ int main(int argc, char **argv)
 
     double coo_gflops = benchmark_coo_spmv(&coo, x, y);
 
+    csr_matrix csr;
+    coo_to_csr(&coo, &csr);
+
+    if (get_arg(argc, argv, "fused") != NULL)
+    {
+        // Krylov methods take dot(x, A x); fall back to a separate vector for rectangular A.
+        float *z = (float *)malloc(coo.num_rows * sizeof(float));
+        for (int i = 0; i < coo.num_rows; i++)
+            z[i] = rand() / (RAND_MAX + 1.0);
+        const float *w = (coo.num_rows == coo.num_cols) ? x : z;
+
+        benchmark_fused_spmv(&csr, x, w, z);
+
+        free(z);
+    }
+
+    if (get_arg(argc, argv, "transpose") != NULL)
+    {
+        // A^T x reads a vector of length num_rows.
+        float *xt = (float *)malloc(coo.num_rows * sizeof(float));
+        for (int i = 0; i < coo.num_rows; i++)
+            xt[i] = rand() / (RAND_MAX + 1.0);
+
+        benchmark_transpose_spmv(&coo, &csr, xt);
+
+        free(xt);
+    }
+
+    if (get_arg(argc, argv, "blocked") != NULL)
+    {
+        char *level = get_argval(argc, argv, "blocked");
+        int cache_level = (level != NULL && (level[0] == 'L' || level[0] == 'l')) ? atoi(level + 1) : 2;
+        benchmark_blocked_spmv(&csr, cache_level, x);
+    }
+
+    if (get_arg(argc, argv, "prefetch") != NULL)
+    {
+        char *dist = get_argval(argc, argv, "prefetch");
+        benchmark_prefetch_spmv(&coo, &csr, x, dist ? atoi(dist) : -1);
+    }
+
+    if (get_arg(argc, argv, "spmspv") != NULL)
+    {
+        char *density = get_argval(argc, argv, "spmspv");
+        benchmark_spmspv(&csr, density ? atof(density) : 0);
+    }
+
+    if (get_arg(argc, argv, "dia") != NULL)
+        benchmark_dia_spmv(&csr, x);
+
+    if (loaded_vals != NULL)
+    {
+        benchmark_dict_spmv(&csr, loaded_vals, x);
+        free(loaded_vals);
+    }
+
+    // --schedule-cache=P only names the cache; --schedule asks for the run.
+    char *kind = get_argval(argc, argv, "schedule");
+    int run_schedule = kind != NULL;
+    for (int i = 1; i < argc; i++)
+        run_schedule |= strcmp(argv[i], "--schedule") == 0;
+    if (run_schedule)
+    {
+        row_schedule sched;
+        if (kind != NULL && !parse_row_schedule(kind, &sched))
+        {
+            printf("Unknown schedule %s\n", kind);
+            return -1;
+        }
+        char cache[PATH_MAX];
+        char *cache_arg = get_argval(argc, argv, "schedule-cache");
+        if (cache_arg != NULL)
+            snprintf(cache, sizeof(cache), "%s", cache_arg);
+        else
+            default_schedule_cache(argv[0], cache, sizeof(cache));
+        benchmark_scheduled_spmv(&csr, x, mm_filename, kind ? &sched : NULL, cache);
+    }
+
+    delete_csr_matrix(&csr);
+
+    if (count_regions)
+        perf_group_close(&region_counters);
+
     delete_coo_matrix(&coo);
     free(x);
     free(y);
@@ -0,0 +1,38 @@
+#ifndef ENERGY_H
+#define ENERGY_H
+
+// Package and DRAM energy from the RAPL zones under /sys/class/powercap
+// (package zones and their DRAM subzones). Energy accumulates across
+// start/stop pairs until energy_reset; a counter wrap at
+// max_energy_range_uj is corrected for once per pair. If no zone is
+// readable the meter is unavailable and energy_print does nothing.
+
+#include <time.h>
+
+#ifndef ENERGY_POWERCAP_DIR
+#define ENERGY_POWERCAP_DIR "/sys/class/powercap"
+#endif
+#define ENERGY_MAX_DOMAINS 16
+
+typedef struct energy_meter
+{
+    int num_domains;
+    char names[ENERGY_MAX_DOMAINS][32];  //"package-0", "dram-0", ...
+    char paths[ENERGY_MAX_DOMAINS][320];  //energy_uj file of each domain
+    unsigned long long max_range[ENERGY_MAX_DOMAINS];  //value (uJ) the counter wraps at, 0 if unknown
+    unsigned long long start[ENERGY_MAX_DOMAINS];
+    double joules[ENERGY_MAX_DOMAINS];  //accumulated since the last reset
+    double seconds;  //wall time accumulated over the same start/stop pairs
+    struct timespec started;
+    int available;  //1 if at least one domain is readable
+    char error[160];  //why the meter is unavailable
+} energy_meter;
+
+int energy_open(energy_meter *m);
+void energy_reset(energy_meter *m);
+void energy_start(energy_meter *m);
+void energy_stop(energy_meter *m);
+void energy_print(const energy_meter *m, const char *region, double flops);
+void energy_report_unavailable(const energy_meter *m);
+
+#endif
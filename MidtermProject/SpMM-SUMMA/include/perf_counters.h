@@ -0,0 +1,40 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+// Hardware event counters through perf_event_open(2): one event group per
+// thread (cycles leads; instructions, LLC/L1D/dTLB misses and branch misses
+// follow). Counts accumulate across start/stop pairs until perf_group_reset.
+// Events the kernel refuses are reported as n/a; without the leader the
+// group is unavailable and perf_group_print does nothing.
+
+#define PERF_MAX_THREADS 256
+
+enum
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_L1D_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_NUM_EVENTS
+};
+
+typedef struct perf_group
+{
+    int nthreads;
+    int fd[PERF_MAX_THREADS][PERF_NUM_EVENTS];  //fd[t][PERF_CYCLES] is thread t's group leader, -1 if not opened
+    int available;  //1 if the leader is open on every thread
+    int open_error;  //errno of the first failed leader open
+    long long counts[PERF_NUM_EVENTS];  //summed over threads, -1 for events that are not counted
+} perf_group;
+
+int perf_group_open(perf_group *g);
+void perf_group_reset(perf_group *g);
+void perf_group_start(perf_group *g);
+void perf_group_stop(perf_group *g);
+void perf_group_close(perf_group *g);
+void perf_group_print(const perf_group *g, const char *region, double work_units, const char *unit_name);
+void perf_group_report_unavailable(const perf_group *g);
+
+#endif
@@ -4,6 +4,8 @@
 #include <time.h>
 #include "spmm.h"
 #include "utils.h"
+#include "perf_counters.h"
+#include "energy.h"
 
 void print_usage() {
     printf("Usage: ./spmm [options]\n");
@@ -18,7 +20,7 @@ void print_usage() {
     printf("  -b, --bcols INT      Number of columns in B\n");
     printf("\nOptional:\n");
     printf("  -v, --verbose        Print detailed output\n");
-    printf("  -m, --metrics        Print performance metrics\n");
+    printf("  -m, --metrics        Print performance metrics (hardware counters, RAPL energy)\n");
     printf("  -h, --help           Print this help\n");
 }
 
@@ -97,10 +99,24 @@ int main(int argc, char *argv[]) {
     }
 
     printf("\nPerforming SpMM...\n");
-    
+
+    perf_group counters;
+    energy_meter energy;
+    if (metrics) {
+        perf_group_open(&counters);
+        energy_open(&energy);
+        energy_start(&energy);
+        perf_group_start(&counters);
+    }
+
     start = clock();
     csr_spmm(A, B, C, B_cols);
     end = clock();
+
+    if (metrics) {
+        perf_group_stop(&counters);
+        energy_stop(&energy);
+    }
     cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
     
     if (verbose) {
@@ -126,6 +142,11 @@ int main(int argc, char *argv[]) {
              cols * B_cols * sizeof(float) +       // Matrix B
              rows * B_cols * sizeof(float)         // Matrix C
             ) / (1024.0 * 1024.0));
+        perf_group_report_unavailable(&counters);
+        perf_group_print(&counters, "csr_spmm", nnz, "nnz");
+        energy_report_unavailable(&energy);
+        energy_print(&energy, "csr_spmm", total_ops);
+        perf_group_close(&counters);
     }
 
     free(B);
@@ -1,5 +1,7 @@
 #include "summa_opts.h"
 #include "utils.h"
+#include "perf_counters.h"
+#include "energy.h"
 #include <math.h>
 #include <mpi.h>
 #include <stdio.h>
@@ -52,7 +54,7 @@ void distribute_matrix_blocks(double *matrix, double *local_block, int rows, int
 }
 
 // Stationary-A SUMMA implementation
-void summa_stationary_a(int m, int n, int k, int nprocs, int rank)
+void summa_stationary_a(int m, int n, int k, int nprocs, int rank, int metrics)
 {
   // Grid setup
   int p = sqrt(nprocs); // Process grid dimension
@@ -81,6 +83,16 @@ void summa_stationary_a(int m, int n, int k, int nprocs, int rank)
   double *B_temp = malloc(block_k * block_n * sizeof(double));
   double *C_local = calloc(block_m * block_n, sizeof(double)); // Initialize C_local to zero
 
+  perf_group dist_counters;
+  energy_meter dist_energy;
+  if (metrics)
+  {
+    perf_group_open(&dist_counters);
+    energy_open(&dist_energy);
+    energy_start(&dist_energy);
+    perf_group_start(&dist_counters);
+  }
+
   if (rank == 0)
   {
     double *A = generate_matrix_A(m, k, 2);
@@ -90,9 +102,25 @@ void summa_stationary_a(int m, int n, int k, int nprocs, int rank)
     free(A);
     free(B);
   }
+
+  if (metrics)
+  {
+    perf_group_stop(&dist_counters);
+    energy_stop(&dist_energy);
+    perf_group_reduce(&dist_counters, 0, MPI_COMM_WORLD);
+    energy_reduce(&dist_energy, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+    {
+      perf_group_report_unavailable(&dist_counters);
+      perf_group_print(&dist_counters, "distribute blocks (all ranks)", (double)m * k + (double)k * n, "element");
+      energy_report_unavailable(&dist_energy);
+      energy_print(&dist_energy, "distribute blocks (all nodes)", 0);
+    }
+    perf_group_close(&dist_counters);
+  }
 }
 
-void summa_stationary_b(int m, int n, int k, int nprocs, int rank)
+void summa_stationary_b(int m, int n, int k, int nprocs, int rank, int metrics)
 {
   // Determine the process grid dimension (p x p, where p = sqrt(nprocs)) [2]
   int p = (int)sqrt(nprocs);
@@ -149,20 +177,68 @@ void summa_stationary_b(int m, int n, int k, int nprocs, int rank)
     free(B);
   }
 
+  // With metrics on, count the broadcast and local GEMM phases separately;
+  // each group accumulates over all panel iterations.
+  perf_group bcast_counters, gemm_counters;
+  energy_meter bcast_energy, gemm_energy;
+  if (metrics)
+  {
+    perf_group_open(&bcast_counters);
+    perf_group_open(&gemm_counters);
+    energy_open(&bcast_energy);
+    energy_open(&gemm_energy);
+  }
+
   // Main SUMMA computation loop over the panel index (iterating over block columns in A)
   for (int iter = 0; iter < p; iter++)
   {
     // In each row, the process whose column coordinate equals iter is the root for current broadcast.
     // Its A_local block is used for this iteration.
+    if (metrics)
+    {
+      energy_start(&bcast_energy);
+      perf_group_start(&bcast_counters);
+    }
     if (myCol == iter)
     {
       memcpy(A_temp, A_local, block_m * block_k * sizeof(double));
     }
     // Broadcast the A block along the row (all processes in the same row receive the block) [3]
     MPI_Bcast(A_temp, block_m * block_k, MPI_DOUBLE, iter, row_comm);
+    if (metrics)
+    {
+      perf_group_stop(&bcast_counters);
+      energy_stop(&bcast_energy);
+      energy_start(&gemm_energy);
+      perf_group_start(&gemm_counters);
+    }
 
     // Compute the local matrix multiplication: C_local += A_temp * B_local
     matmul(A_temp, B_local, C_local, block_m, block_n, block_k);
+    if (metrics)
+    {
+      perf_group_stop(&gemm_counters);
+      energy_stop(&gemm_energy);
+    }
+  }
+
+  if (metrics)
+  {
+    perf_group_reduce(&bcast_counters, 0, MPI_COMM_WORLD);
+    perf_group_reduce(&gemm_counters, 0, MPI_COMM_WORLD);
+    energy_reduce(&bcast_energy, 0, MPI_COMM_WORLD);
+    energy_reduce(&gemm_energy, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+    {
+      perf_group_report_unavailable(&gemm_counters);
+      perf_group_print(&bcast_counters, "A broadcast (all ranks)", (double)m * k * p, "element");
+      perf_group_print(&gemm_counters, "local GEMM (all ranks)", 2.0 * m * n * k, "flop");
+      energy_report_unavailable(&gemm_energy);
+      energy_print(&bcast_energy, "A broadcast (all nodes)", 0);
+      energy_print(&gemm_energy, "local GEMM (all nodes)", 2.0 * m * n * k);
+    }
+    perf_group_close(&bcast_counters);
+    perf_group_close(&gemm_counters);
   }
 
   // Gather the computed C blocks back to the root process.
@@ -243,6 +319,7 @@ int main(int argc, char *argv[])
   MPI_Bcast(&(opts.block_size), 1, MPI_INT, 0, MPI_COMM_WORLD);
   MPI_Bcast(&(opts.stationary), 1, MPI_CHAR, 0, MPI_COMM_WORLD);
   MPI_Bcast(&(opts.verbose), 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&(opts.metrics), 1, MPI_INT, 0, MPI_COMM_WORLD);
 
   // Check if the number of processes forms a perfect square grid
   int grid_size = (int)sqrt((double)nprocs);
@@ -283,11 +360,11 @@ int main(int argc, char *argv[])
   // Call the appropriate SUMMA function based on the stationary option
   if (opts.stationary == 'a')
   {
-    summa_stationary_a(opts.m, opts.n, opts.k, nprocs, rank);
+    summa_stationary_a(opts.m, opts.n, opts.k, nprocs, rank, opts.metrics);
   }
   else if (opts.stationary == 'b')
   {
-    summa_stationary_b(opts.m, opts.n, opts.k, nprocs, rank);
+    summa_stationary_b(opts.m, opts.n, opts.k, nprocs, rank, opts.metrics);
   }
   else
   {
@@ -0,0 +1,222 @@
+// src/perf_counters.c
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "perf_counters.h"
+
+static const char *perf_event_names[PERF_NUM_EVENTS] = {
+    "cycles", "instructions", "LLC-misses", "L1D-misses", "dTLB-misses", "branch-misses"};
+
+#define PERF_HW_CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const unsigned int perf_event_types[PERF_NUM_EVENTS] = {
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+    PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+
+static const unsigned long long perf_event_configs[PERF_NUM_EVENTS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D),
+    PERF_HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB),
+    PERF_COUNT_HW_BRANCH_MISSES};
+
+static int perf_event_open_self(unsigned int type, unsigned long long config, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = (group_fd == -1);  //siblings follow the leader
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // pid 0 / cpu -1: the calling thread, on whatever CPU it runs.
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static int perf_group_num_threads(void)
+{
+#ifdef _OPENMP
+    int nthreads = omp_get_max_threads();
+    return nthreads > PERF_MAX_THREADS ? PERF_MAX_THREADS : nthreads;
+#else
+    return 1;
+#endif
+}
+
+// Open the event group on the calling thread (slot t).
+static void perf_group_open_thread(perf_group *g, int t)
+{
+    for (int e = 0; e < PERF_NUM_EVENTS; e++)
+        g->fd[t][e] = -1;
+
+    g->fd[t][PERF_CYCLES] = perf_event_open_self(perf_event_types[PERF_CYCLES], perf_event_configs[PERF_CYCLES], -1);
+    if (g->fd[t][PERF_CYCLES] < 0)
+    {
+        g->open_error = errno;
+        return;
+    }
+    for (int e = PERF_CYCLES + 1; e < PERF_NUM_EVENTS; e++)
+        g->fd[t][e] = perf_event_open_self(perf_event_types[e], perf_event_configs[e], g->fd[t][PERF_CYCLES]);
+}
+
+void perf_group_reset(perf_group *g)
+{
+    for (int e = 0; e < PERF_NUM_EVENTS; e++)
+        g->counts[e] = -1;
+    for (int t = 0; t < g->nthreads; t++)
+        if (g->fd[t][PERF_CYCLES] >= 0)
+            ioctl(g->fd[t][PERF_CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+}
+
+// Open one group per OpenMP thread. Returns 1 if counting is possible.
+int perf_group_open(perf_group *g)
+{
+    g->nthreads = perf_group_num_threads();
+    g->open_error = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(g->nthreads)
+    perf_group_open_thread(g, omp_get_thread_num());
+#else
+    perf_group_open_thread(g, 0);
+#endif
+
+    g->available = 1;
+    for (int t = 0; t < g->nthreads; t++)
+        if (g->fd[t][PERF_CYCLES] < 0)
+            g->available = 0;
+
+    perf_group_reset(g);
+    return g->available;
+}
+
+void perf_group_start(perf_group *g)
+{
+    if (!g->available)
+        return;
+    for (int t = 0; t < g->nthreads; t++)
+        ioctl(g->fd[t][PERF_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+// Stop counting and refresh g->counts with the totals since the last reset,
+// scaled up if the kernel had to multiplex the group.
+void perf_group_stop(perf_group *g)
+{
+    if (!g->available)
+        return;
+
+    long long totals[PERF_NUM_EVENTS] = {0};
+    int counted[PERF_NUM_EVENTS] = {0};
+    for (int e = 0; e < PERF_NUM_EVENTS; e++)
+        counted[e] = 1;
+
+    for (int t = 0; t < g->nthreads; t++)
+    {
+        ioctl(g->fd[t][PERF_CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+        // nr, time_enabled, time_running, then one value per group member.
+        unsigned long long buf[3 + PERF_NUM_EVENTS];
+        if (read(g->fd[t][PERF_CYCLES], buf, sizeof(buf)) < (ssize_t)(3 * sizeof(buf[0])))
+        {
+            g->available = 0;
+            return;
+        }
+        double scale = (buf[2] > 0 && buf[2] < buf[1]) ? (double)buf[1] / buf[2] : 1.0;
+
+        int member = 0;
+        for (int e = 0; e < PERF_NUM_EVENTS; e++)
+        {
+            if (g->fd[t][e] < 0)
+            {
+                counted[e] = 0;
+                continue;
+            }
+            totals[e] += (long long)(buf[3 + member++] * scale);
+        }
+    }
+
+    for (int e = 0; e < PERF_NUM_EVENTS; e++)
+        g->counts[e] = counted[e] ? totals[e] : -1;
+}
+
+void perf_group_close(perf_group *g)
+{
+    for (int t = 0; t < g->nthreads; t++)
+        for (int e = 0; e < PERF_NUM_EVENTS; e++)
+            if (g->fd[t][e] >= 0)
+                close(g->fd[t][e]);
+    g->nthreads = 0;
+    g->available = 0;
+}
+
+// One line of raw counts and one of derived metrics for a region. work_units
+// is what "per unit" metrics divide by (nonzeros for SpMV, flops for GEMM).
+void perf_group_print(const perf_group *g, const char *region, double work_units, const char *unit_name)
+{
+    if (!g->available)
+        return;
+
+    const long long *c = g->counts;
+    printf("[perf] %s:", region);
+    for (int e = 0; e < PERF_NUM_EVENTS; e++)
+    {
+        if (c[e] >= 0)
+            printf(" %s=%lld", perf_event_names[e], c[e]);
+        else
+            printf(" %s=n/a", perf_event_names[e]);
+    }
+    printf("\n[perf] %s:", region);
+    if (c[PERF_CYCLES] > 0 && c[PERF_INSTRUCTIONS] >= 0)
+        printf(" IPC=%.2f", (double)c[PERF_INSTRUCTIONS] / c[PERF_CYCLES]);
+    for (int e = PERF_LLC_MISSES; e < PERF_NUM_EVENTS; e++)
+        if (c[e] >= 0 && work_units > 0)
+            printf(" %s/%s=%.4f", perf_event_names[e], unit_name, c[e] / work_units);
+    printf("\n");
+}
+
+// Print why counting is off, once, from the caller's chosen rank/thread.
+void perf_group_report_unavailable(const perf_group *g)
+{
+    if (!g->available)
+        printf("[perf] hardware counters unavailable (%s); counts not reported\n",
+               g->open_error ? strerror(g->open_error) : "not available");
+}
+
+// Sum every rank's counts into root's g->counts. An event that is missing on
+// any rank is reported as n/a; the group is available on root only if it is
+// available everywhere.
+void perf_group_reduce(perf_group *g, int root, MPI_Comm comm)
+{
+    long long counts[PERF_NUM_EVENTS], totals[PERF_NUM_EVENTS];
+    int present[PERF_NUM_EVENTS + 1], all_present[PERF_NUM_EVENTS + 1];
+
+    for (int e = 0; e < PERF_NUM_EVENTS; e++)
+    {
+        present[e] = g->available && g->counts[e] >= 0;
+        counts[e] = present[e] ? g->counts[e] : 0;
+    }
+    present[PERF_NUM_EVENTS] = g->available;
+
+    MPI_Reduce(counts, totals, PERF_NUM_EVENTS, MPI_LONG_LONG, MPI_SUM, root, comm);
+    MPI_Reduce(present, all_present, PERF_NUM_EVENTS + 1, MPI_INT, MPI_MIN, root, comm);
+
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    if (rank != root)
+        return;
+    for (int e = 0; e < PERF_NUM_EVENTS; e++)
+        g->counts[e] = all_present[e] ? totals[e] : -1;
+    g->available = all_present[PERF_NUM_EVENTS];
+}
@@ -13,7 +13,7 @@ void print_usage(const char* prog_name) {
     printf("  -b, --block INT     Block size for tiled operations\n");
     printf("  -s, --stationary    Algorithm variant ('a' or 'b')\n");
     printf("  -v, --verbose       Print detailed output\n");
-    printf("  -p, --perf         Print performance metrics\n");
+    printf("  -p, --perf         Print performance metrics, hardware counters and RAPL energy\n");
     printf("  -h, --help         Print this help\n");
 }
 